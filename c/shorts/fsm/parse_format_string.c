@@ -1,6 +1,9 @@
 // input string format:  %<alignment>:<color>:<unit>{<extendedOption>}
 //      note 1. <alignment>, <color> and <extendedOption >might be skipped
 //      note 2. drefault values would be applied instead
+//      note 3. "json:" or "logfmt:" prefix makes every unit a key/value pair
+//      note 4. "|coarse" or "|tsc" at the end of timestamp option selects cheaper clock, e.g. %timestamp{%T.%f|tsc},
+//              every format reads its own clock
 
 #include <stdio.h>
 #include <string.h>
@@ -11,16 +14,45 @@
 #include <time.h>
 #include <stdarg.h>
 #include <sys/timeb.h>
+#include <stdatomic.h>
+#include <stdalign.h>
 
 #ifdef __linux__
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <sys/uio.h>
+    #include <sys/syscall.h>
     #include <pthread.h>
+    #include <sched.h>
+    #include <signal.h>
     #include <errno.h>
+    #ifdef __has_include
+        #if __has_include(<linux/io_uring.h>) && defined(SYS_io_uring_setup)
+            #include <linux/io_uring.h>
+            #define LOG_URING_SUPPORTED
+        #endif
+    #endif
+    #if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+        #include <x86intrin.h>
+        #include <cpuid.h>
+        #define LOG_TSC_SUPPORTED
+    #endif
 #elif defined(_WIN32)
     #include <Windows.h>
     #include <io.h>
     #define write _write
     #define fileno _fileno
+    #define aligned_alloc(alignment, size) _aligned_malloc(size, alignment)
+    #define aligned_free _aligned_free
+    #define localtime_r(time, result) localtime_s(result, time)
+    #define sched_yield SwitchToThread
+    #define isatty _isatty
+#endif
+
+#ifndef aligned_free
+    #define aligned_free free
 #endif
 
 
@@ -31,7 +63,7 @@
     #define _S(string) printf("%s\n", string)
     #define _C(symbol) printf("char=%c", symbol)
     #define _RESULT                                                                 \
-            printf("  result = %d (%d)\n", result, abs(fmtNode->alignment));        \
+            printf("  result = %d (%d)\n", result, fmtNode->width);        \
             printf("  bufPosition = '%s'\n", bufPosition);                          \
             printf("  buffer = '%s'\n", buffer);
 #else 
@@ -42,7 +74,6 @@
 
 // TODO:
 //      struct handlers for stdout and file
-//      possibility to change format in process (roll and reopen)
 //      windows 
 //          time
 //          thread
@@ -57,7 +88,74 @@
  ************************************************************************/
 
 // constants
-#define LOG_RECORD_MAX_SIZE     (256)
+#define LOG_RECORD_INITIAL_SIZE (256)   // per-thread buffers grow from it
+
+// async mode
+#define LOG_ASYNC_SLOT_SIZE     (320)   // multiple of cache line, longer records are stored on the heap
+#define LOG_ASYNC_BATCH_SIZE    (64 * 1024)
+#define LOG_ASYNC_BATCH_RECORDS (256)
+#define LOG_ASYNC_IDLE_MS       (100)
+#define LOG_ASYNC_PENDING_IDLE  (0)     // producer isn't writing a record
+#define LOG_ASYNC_PENDING_CLOCK (1)     // producer is about to take the timestamp
+
+// file sink
+#define LOG_FILE_BUFFER_DEFAULT (1024 * 1024)
+#define LOG_FILE_PATH_MAX       (4096)
+#define LOG_FILE_MODE           (0644)
+#define LOG_HOUSEKEEPER_MS      (1000)  // longest housekeeper sleep
+#define LOG_ROTATE_RETRY_SEC    (30)    // size trigger is off for that long after a failed rotation
+#define LOG_URING_BUFFERS       (4)     // registered buffers of io_uring backend, each of bufferSize
+
+// stdout batching
+#define LOG_STDOUT_BUFFER_DEFAULT (64 * 1024)
+
+// self-metrics
+#define LOG_STATS_LATENCY_BUCKETS   (16)    // bucket i counts writes faster than 256 ns << i, the last one the rest
+#define LOG_STATS_LATENCY_SHIFT     (8)     // 256 ns: the first bucket bound
+#define LOG_STATS_LATENCY_SAMPLE    (16)    // 1 of N sink writes per thread is timed
+
+// counter of the thread's context: owner is the only writer, no atomic RMW
+#define LOG_STATS_ADD(counter, value)                                                                   \
+    atomic_store_explicit(&(counter), atomic_load_explicit(&(counter), memory_order_relaxed) + (value), \
+                          memory_order_relaxed)
+
+// TSC clock
+#define LOG_TSC_CALIBRATE_MS    (10)    // calibration window, ratio error is ~1e-5
+#define LOG_TSC_RESYNC_MS       (1000)  // re-based on the realtime clock at least that often
+#define LOG_TSC_SHIFT           (32)    // fixed point of ns per tick
+
+// benchmark
+#define LOG_BENCH_THREADS_DEFAULT   (4)
+#define LOG_BENCH_RECORDS_DEFAULT   (100000)    // per thread
+#define LOG_BENCH_MESSAGE_DEFAULT   (64)
+#define LOG_BENCH_PATH_DEFAULT      "/tmp/log_bench"
+#define LOG_BENCH_ASYNC_CAPACITY    (16384)     // queue of async mode, power of two
+
+// memory-mapped sink
+#define LOG_MMAP_SEGMENT_DEFAULT (64 * 1024 * 1024)
+#define LOG_MMAP_NAME_MAX       (LOG_FILE_PATH_MAX + 16)
+
+// binary mode
+#define LOG_BINARY_MAGIC        "LOGBIN1"   // with terminator: 8 bytes
+#define LOG_BINARY_MAGIC_LEN    (sizeof(LOG_BINARY_MAGIC))
+#define LOG_BINARY_BUFFER_SIZE  (64 * 1024)
+#define LOG_BINARY_MAX_ARGS     (16)
+#define LOG_BINARY_STRING_MAX   (1024)  // longer string arguments are truncated
+#define LOG_BINARY_SITES_MAX    (4096)
+#define LOG_BINARY_PREFORMATTED (0xFF)  // argCount of sites stored as rendered text
+#define LOG_BINARY_EVENT_HEADER (1 + 4 + 8 + 8 + 4)
+#define LOG_BINARY_EVENT_MAX    (LOG_BINARY_EVENT_HEADER + LOG_BINARY_MAX_ARGS * (4 + LOG_BINARY_STRING_MAX))
+#define LOG_BINARY_THREAD_MAX   (1 + 8 + 1 + LOG_THREAD_LABEL_MAX)
+#define LOG_BINARY_SPEC_MAX     (32)
+
+// flight recorder
+#define LOG_RECORDER_SLOT_SIZE      (256)   // longer arguments are truncated
+#define LOG_RECORDER_SLOTS_DEFAULT  (1024)  // per thread, power of two
+
+// call site argument types cache
+#define LOG_SITE_ARGS_UNKNOWN   (0)
+#define LOG_SITE_ARGS_BUSY      (1)
+#define LOG_SITE_ARGS_READY     (2)
 
 // format triggers
 #define FMT_UNIT_FIRST          '%' 
@@ -74,8 +172,43 @@
 #define FMT_EXT_OPT_FIRST_STR   "{"     // nust be align with FMT_EXT_OPT_FIRST
 #define FMT_ALIGN_DEFAULT       (0)
 #define FMT_MS_SYMBOL           'f'
+#define FMT_CLOCK_SEPAR         '|'     // %T.%f|tsc
+#define FMT_MS_DIGITS_SYMBOL    '3'     // %3f is the same as %f
+#define FMT_US_DIGITS_SYMBOL    '6'     // %6f gives microseconds
 #define FMT_UNIT_MAX_SEPARS     (2)
 #define FMT_UNIT_SEPAR          ':'
+#define FMT_COLOR_MAX_LEN       (UINT8_MAX)
+
+// format program helpers
+#define FMT_CACHE_LINE          (64)
+#define FMT_OPS_INITIAL         (16)
+#define FMT_POOL_INITIAL        (256)
+#define FMT_ROUND_UP(size, to)  ((((size) + (to) - 1) / (to)) * (to))
+
+// FmtOp flags
+#define FMT_OP_TS_MS            (0x01)  // timestamp is followed by milliseconds
+#define FMT_OP_TS_US            (0x02)  // timestamp is followed by microseconds
+#define FMT_OP_PAD_RIGHT        (0x04)  // negative alignment: value is left-justified
+#define FMT_OP_JSON             (0x08)  // value is escaped as JSON string content
+#define FMT_OP_LOGFMT           (0x10)  // value is quoted and escaped if logfmt requires
+#define FMT_OP_STRUCTURED       (FMT_OP_JSON | FMT_OP_LOGFMT)
+
+// structured records
+#define FMT_KEY_MAX_LEN         (32)
+
+// color reset suffix
+#define FMT_COLOR_RESET         "\033[m"
+#define FMT_COLOR_RESET_LEN     (sizeof(FMT_COLOR_RESET) - 1)
+
+// number rendering helpers
+#define LOG_DECIMAL_MAX_LEN     (20)    // UINT64_MAX
+
+// thread label: kernel thread id or user-assigned name
+#define LOG_THREAD_LABEL_MAX    (32)
+
+// timestamp helpers
+#define FMT_TS_MAX_LEN          (32)
+#define FMT_TS_CACHE_SLOTS      (8)     // power of two
 
 // format break helpers
 #define FMT_ERROR_IF_FALSE(statement)           \
@@ -92,16 +225,92 @@
         break;                                  \
     }
 
-// code location
-#define __FILENAME_FORWARDSLASH__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
-#define __FILENAME__ (strrchr(__FILENAME_FORWARDSLASH__, '\\') ? strrchr(__FILENAME_FORWARDSLASH__, '\\') + 1 : __FILENAME_FORWARDSLASH__)
+// code location: basename is known at compile time by gcc 12+ and clang,
+// otherwise it's found once per call site
+#ifdef __FILE_NAME__
+    #define LOG_SITE_FILE       __FILE_NAME__
+#else
+    #define LOG_SITE_FILE       __FILE__
+#endif
+
+// severity levels for the preprocessor, must be align with LogSeverityEnum
+#define LOG_LEVEL_ERROR         (0)
+#define LOG_LEVEL_WARN          (1)
+#define LOG_LEVEL_INFO          (2)
+#define LOG_LEVEL_DEBUG         (3)
+#define LOG_LEVEL_TRACE         (4)
+
+// macros of less important severities expand to nothing, 
+// e.g. -DLOG_STRIP_BELOW=LOG_LEVEL_INFO removes DEBUG and TRACE
+#ifndef LOG_STRIP_BELOW
+    #define LOG_STRIP_BELOW     LOG_LEVEL_TRACE
+#endif
+
+// runtime filter: single load and branch, arguments aren't evaluated if disabled
+#define LOG_ENABLED(severity)   (atomic_load_explicit(&logEnabledMask, memory_order_relaxed) & (1u << (severity)))
+
+// format is the first of the macro arguments: taken alone for the descriptor,
+// the trailing 0 gives the variadic part an argument when the format has none
+#define LOG_FORMAT(format, ...) format
+
+// every expansion owns a constant call site descriptor, write_log() gets its address
+// and the format again, so the argument list is never empty in standard C;
+// printf() is never called, it makes the compiler check arguments against the format
+#define LOG_IF_ENABLED(sev, binarySite, ...)                                        \
+    do                                                                              \
+    {                                                                               \
+        static LogSiteState logSiteState;                                           \
+        static const LogSite logSite =                                              \
+        {                                                                           \
+            .file = LOG_SITE_FILE,                                                  \
+            .fmt = LOG_FORMAT(__VA_ARGS__, 0),                                      \
+            .line = __LINE__,                                                       \
+            .severity = sev,                                                        \
+            .state = &logSiteState,                                                 \
+            .binary = binarySite                                                    \
+        };                                                                          \
+        (void)(0 && printf(__VA_ARGS__));                                           \
+        if (LOG_ENABLED(sev))                                                       \
+        {                                                                           \
+            write_log(&logSite, __VA_ARGS__);                                       \
+        }                                                                           \
+    } while (0)
+
+// severity macros, *_BINARY sites are stored raw while binary mode is active
+#define ERR(...)                LOG_IF_ENABLED(LOG_SEVERITY_ERROR_E, false, __VA_ARGS__)
+#define ERR_BINARY(...)         LOG_IF_ENABLED(LOG_SEVERITY_ERROR_E, true,  __VA_ARGS__)
+
+#if LOG_STRIP_BELOW >= LOG_LEVEL_WARN
+    #define WARN(...)           LOG_IF_ENABLED(LOG_SEVERITY_WARN_E,  false, __VA_ARGS__)
+    #define WARN_BINARY(...)    LOG_IF_ENABLED(LOG_SEVERITY_WARN_E,  true,  __VA_ARGS__)
+#else
+    #define WARN(...)           ((void)0)
+    #define WARN_BINARY(...)    ((void)0)
+#endif
+
+#if LOG_STRIP_BELOW >= LOG_LEVEL_INFO
+    #define INFO(...)           LOG_IF_ENABLED(LOG_SEVERITY_INFO_E,  false, __VA_ARGS__)
+    #define INFO_BINARY(...)    LOG_IF_ENABLED(LOG_SEVERITY_INFO_E,  true,  __VA_ARGS__)
+#else
+    #define INFO(...)           ((void)0)
+    #define INFO_BINARY(...)    ((void)0)
+#endif
+
+#if LOG_STRIP_BELOW >= LOG_LEVEL_DEBUG
+    #define DEBUG(...)          LOG_IF_ENABLED(LOG_SEVERITY_DEBUG_E, false, __VA_ARGS__)
+    #define DEBUG_BINARY(...)   LOG_IF_ENABLED(LOG_SEVERITY_DEBUG_E, true,  __VA_ARGS__)
+#else
+    #define DEBUG(...)          ((void)0)
+    #define DEBUG_BINARY(...)   ((void)0)
+#endif
 
-// severity macros
-#define ERR(...)        write_log(LOG_SEVERITY_ERROR_E,  __FILENAME__, __LINE__, __VA_ARGS__)	
-#define WARN(...)       write_log(LOG_SEVERITY_WARN_E,   __FILENAME__, __LINE__, __VA_ARGS__)	
-#define INFO(...)       write_log(LOG_SEVERITY_INFO_E,   __FILENAME__, __LINE__, __VA_ARGS__)	
-#define DEBUG(...)      write_log(LOG_SEVERITY_DEBUG_E,  __FILENAME__, __LINE__, __VA_ARGS__)	
-#define TRACE(...)      write_log(LOG_SEVERITY_TRACE_E,  __FILENAME__, __LINE__, __VA_ARGS__)	
+#if LOG_STRIP_BELOW >= LOG_LEVEL_TRACE
+    #define TRACE(...)          LOG_IF_ENABLED(LOG_SEVERITY_TRACE_E, false, __VA_ARGS__)
+    #define TRACE_BINARY(...)   LOG_IF_ENABLED(LOG_SEVERITY_TRACE_E, true,  __VA_ARGS__)
+#else
+    #define TRACE(...)          ((void)0)
+    #define TRACE_BINARY(...)   ((void)0)
+#endif
 
 
 /************************************************************************
@@ -150,21 +359,98 @@ const char* fmtUnitMnemonics[FMT_UNIT_MAX_E] =
     [FMT_ENDLINE_E]   = "endl"      , 
 };
 
-typedef struct FmtUnitNodeS
+// record syntax, selected by the format prefix, e.g. "json:%timestamp %message"
+typedef enum FmtStructureE
 {
-    FmtUnitsEnum unit;
-    long alignment;
-    char* color;
-    char extOption[FMT_BUFF_SIZE];
-    char gap[FMT_BUFF_SIZE];
-    struct FmtUnitNodeS* next;
-} FmtUnitNode;
+    FMT_STRUCTURE_NONE_E = 0,   // human-oriented text
+    FMT_STRUCTURE_JSON_E,       // {"unit":"value",...}
+    FMT_STRUCTURE_LOGFMT_E,     // unit=value ...
+    FMT_STRUCTURE_MAX_E
+} FmtStructureEnum;
+
+const char* fmtStructurePrefixes[FMT_STRUCTURE_MAX_E] =
+{
+    [FMT_STRUCTURE_NONE_E]   = ""        ,
+    [FMT_STRUCTURE_JSON_E]   = "json:"   ,
+    [FMT_STRUCTURE_LOGFMT_E] = "logfmt:" ,
+};
+
+// clock of the timestamp unit, from the most precise one
+typedef enum FmtClockE
+{
+    FMT_CLOCK_REALTIME_E = 0,   // clock_gettime(CLOCK_REALTIME)
+    FMT_CLOCK_TSC_E,            // calibrated TSC, coarse clock if it isn't usable
+    FMT_CLOCK_COARSE_E,         // clock_gettime(CLOCK_REALTIME_COARSE), tick is a few ms
+    FMT_CLOCK_MAX_E             // format has no timestamp
+} FmtClockEnum;
+
+const char* fmtClockNames[FMT_CLOCK_MAX_E] =
+{
+    [FMT_CLOCK_REALTIME_E] = "realtime" ,
+    [FMT_CLOCK_TSC_E]      = "tsc"      ,
+    [FMT_CLOCK_COARSE_E]   = "coarse"   ,
+};
+
+// single instruction of the format program: 4 ops per cache line
+typedef struct FmtOpS
+{
+    uint8_t unit;           // FmtUnitsEnum, FMT_UNIT_MAX_E means gap
+    uint8_t colorLen;
+    uint16_t textLen;       // gap or extended option length
+    uint16_t width;         // resolved alignment, see FMT_OP_PAD_RIGHT
+    uint8_t flags;          // FMT_OP_* unit specific options
+    uint8_t reserved;
+    uint32_t text;          // pool offset of gap or extended option
+    uint32_t color;         // pool offset of color
+} FmtOp;
+
+// compiled format: header, ops and literal pool share one allocation
+typedef struct FmtProgramS
+{
+    FmtOp* ops;
+    char* pool;
+    uint32_t opsCount;
+    uint32_t poolSize;
+    uint32_t generation;    // unique per compiled program, never reused
+    uint8_t clock;          // FmtClockEnum: the most precise clock of timestamp units
+} FmtProgram;
+
+// growable storage used while the format is being parsed, 
+// common formats fit the inline parts and don't touch the heap
+typedef struct FmtProgramBuilderS
+{
+    FmtOp* ops;
+    size_t opsCount;
+    size_t opsCapacity;
+    char* pool;
+    size_t poolSize;
+    size_t poolCapacity;
+    FmtOp opsInline[FMT_OPS_INITIAL];
+    char poolInline[FMT_POOL_INITIAL];
+    bool colorless;         // target isn't a terminal: colors are dropped
+    uint8_t clock;          // FmtClockEnum
+
+    // structured records: units become key/value pairs, gaps are dropped
+    uint8_t structure;      // FmtStructureEnum
+    bool quoteOpen;         // JSON string value of the last unit isn't closed yet
+    bool hasFields;
+} FmtProgramBuilder;
+
+// thread-local rendered strftime() part of a timestamp unit for one second
+typedef struct FmtTsCacheS
+{
+    const FmtOp* op;
+    uint32_t generation;
+    uint8_t length;
+    time_t second;
+    char text[FMT_TS_MAX_LEN];
+} FmtTsCache;
 
 typedef bool (*parserCallback)(void* arg);
 
 typedef struct FmtParserS
 {
-    int output;
+    FmtProgramBuilder* builder;
     bool parsed;
     parserCallback callback;
 
@@ -179,7 +465,7 @@ typedef struct FmtParserS
 
     FmtUnitsEnum unit;
     long align;
-    char* color;
+    char color[FMT_BUFF_SIZE];              // empty if not given
     char extOption[FMT_BUFF_SIZE];
 } FmtParser;
 
@@ -187,6 +473,7 @@ typedef enum LogOutputIdE
 {
 	LOG_OUTPUT_ID_STDOUT_E = 0,
 	LOG_OUTPUT_ID_FILE_E,
+	LOG_OUTPUT_ID_MMAP_E,
 	LOG_OUTPUT_ID_MAX_E,
 } LogOutputIdEnum;
 
@@ -200,6 +487,38 @@ typedef enum LogSeverityE
 	LOG_SEVERITY_MAX_E,
 } LogSeverityEnum;
 
+// mutable part of a call site, zeroed before main()
+typedef struct LogSiteStateS
+{
+    const char* _Atomic file;   // basename, if the compiler can't provide it
+    _Atomic uint64_t binary;    // binary mode: sink generation << 32 | site id
+
+    // limits
+    atomic_uint sampled;        // records seen by 1-in-N sampling
+    _Atomic uint64_t arrival;   // token bucket as theoretical arrival time, ns
+    atomic_uint suppressed;     // dropped since the last passed record
+
+    // argument types of the format for raw storing
+    atomic_uchar argState;      // LOG_SITE_ARGS_*
+    uint8_t argCount;
+    uint8_t args[LOG_BINARY_MAX_ARGS];
+} LogSiteState;
+
+// call site descriptor, one per log macro expansion
+typedef struct LogSiteS
+{
+    const char* file;
+    const char* fmt;
+    int line;
+    LogSeverityEnum severity;
+    LogSiteState* state;
+    bool unlimited;             // limits are not applied
+    bool binary;                // goes to the binary sink instead of the outputs while it's open
+} LogSite;
+
+_Static_assert((LOG_SEVERITY_ERROR_E == LOG_LEVEL_ERROR) && (LOG_SEVERITY_TRACE_E == LOG_LEVEL_TRACE), "severity levels mismatch");
+
+// fixed width: severity unit is prerendered by the parser
 const char* severitiesString[LOG_SEVERITY_MAX_E] = 
 {
     "ERROR",
@@ -209,16 +528,626 @@ const char* severitiesString[LOG_SEVERITY_MAX_E] =
     "TRACE"
 };
 
+// symbol escaped in JSON strings and quoted logfmt values: 0 means copied as is,
+// 'u' means \u00XX, otherwise the symbol goes after a backslash
+static const char fmtEscapes[256] = 
+{
+    [0x00] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u', [0x05] = 'u', [0x06] = 'u', [0x07] = 'u',
+    [0x08] = 'b', [0x09] = 't', [0x0A] = 'n', [0x0B] = 'u', [0x0C] = 'f', [0x0D] = 'r', [0x0E] = 'u', [0x0F] = 'u',
+    [0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u', [0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u',
+    [0x18] = 'u', [0x19] = 'u', [0x1A] = 'u', [0x1B] = 'u', [0x1C] = 'u', [0x1D] = 'u', [0x1E] = 'u', [0x1F] = 'u',
+    ['"'] = '"', ['\\'] = '\\', [0x7F] = 'u'
+};
+
+// two digits per lookup for decimal rendering
+static const char digitPairs[] = 
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// everything units need to be rendered, captured once per write_log()
+typedef struct LogRecordS
+{
+    LogSeverityEnum severity;
+    const char* file;
+    int line;
+    const char* message;    // user message is formatted once for all outputs
+    size_t messageLen;
+    struct timespec timestamp;
+    uint64_t thread;
+    const char* threadLabel;    // rendered once per thread
+    size_t threadLabelLen;
+} LogRecord;
+
+typedef enum LogOverflowPolicyE
+{
+    LOG_OVERFLOW_BLOCK_E = 0,       // producer waits until writer frees a slot
+    LOG_OVERFLOW_DROP_NEWEST_E,     // record being logged is discarded
+    LOG_OVERFLOW_DROP_OLDEST_E,     // oldest queued record is discarded
+    LOG_OVERFLOW_MAX_E,
+} LogOverflowPolicyEnum;
+
+typedef struct LogFileConfigS
+{
+    const char* path;
+    size_t bufferSize;              // user-space buffer, 0 means LOG_FILE_BUFFER_DEFAULT
+    uint32_t flushIntervalMs;       // buffer age limit, 0 disables timed flush
+    LogSeverityEnum flushSeverity;  // this and more important records are flushed at once
+    size_t rotateSize;              // 0 disables rotation by size
+    uint32_t rotatePeriodSec;       // aligned to wall clock, 0 disables rotation by time
+    bool uring;                     // write by io_uring if the kernel allows, by write() otherwise
+} LogFileConfig;
+
+// records are written to stdout by batches: one syscall per many lines
+typedef struct LogStdoutConfigS
+{
+    size_t bufferSize;              // byte threshold, 0 means LOG_STDOUT_BUFFER_DEFAULT
+    uint32_t flushRecords;          // record count threshold, 0 disables it
+    uint32_t flushIntervalMs;       // age limit of the oldest buffered record, 0 disables it
+    LogSeverityEnum flushSeverity;  // this and more important records are flushed at once
+} LogStdoutConfig;
+
+// logging self-metrics, summed over all threads since start
+typedef struct LogStatsS
+{
+    uint64_t records[LOG_SEVERITY_MAX_E];   // passed filters and limits
+    uint64_t suppressed;                    // dropped by limits
+    uint64_t dropped;                       // passed, but lost: full async queue, out of memory, binary sites overflow
+    uint64_t truncated;                     // cut short because the buffer couldn't grow
+    uint64_t bytes[LOG_OUTPUT_ID_MAX_E];    // handed to the output sink
+    uint64_t asyncDepthMax;                 // most records ever waiting for the async writer
+    uint64_t latency[LOG_OUTPUT_ID_MAX_E][LOG_STATS_LATENCY_BUCKETS];   // sampled sink write time
+} LogStats;
+
+typedef enum LogBenchSinkE
+{
+    LOG_BENCH_SINK_NULL_E = 0,  // stdout redirected to /dev/null
+    LOG_BENCH_SINK_PIPE_E,      // stdout redirected to a pipe, drained by a reader thread
+    LOG_BENCH_SINK_FILE_E,
+    LOG_BENCH_SINK_MMAP_E,
+    LOG_BENCH_SINK_MAX_E,
+} LogBenchSinkEnum;
+
+typedef struct LogBenchConfigS
+{
+    LogBenchSinkEnum sink;
+    const char* format;
+    const char* path;           // file or segments prefix, LOG_BENCH_PATH_DEFAULT if NULL
+    unsigned int threads;
+    size_t records;             // per thread
+    size_t messageSize;
+    bool async;
+    bool perThread;             // async with per-thread queues
+    bool batch;                 // stdout batching, null and pipe sinks
+    bool uring;                 // io_uring backend, file sink
+} LogBenchConfig;
+
+// counters of LogStats, written by the owner of the context only
+typedef struct LogThreadStatsS
+{
+    _Atomic uint64_t records[LOG_SEVERITY_MAX_E];
+    _Atomic uint64_t suppressed;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t truncated;
+    _Atomic uint64_t bytes[LOG_OUTPUT_ID_MAX_E];
+    _Atomic uint64_t asyncDepthMax;
+    _Atomic uint64_t latency[LOG_OUTPUT_ID_MAX_E][LOG_STATS_LATENCY_BUCKETS];
+    uint64_t writes;                // picks sampled writes
+} LogThreadStats;
+
+// per-thread state, created on the first record and reused after thread exit
+typedef struct LogThreadContextS
+{
+    atomic_bool alive;
+    struct LogThreadContextS* next;
+
+    // global epoch observed while formats and sinks are in use, 0 when idle
+    _Atomic uint64_t epoch;
+
+    // identity, set when a thread takes the context
+    uint64_t threadId;
+    char threadLabel[LOG_THREAD_LABEL_MAX];
+    uint8_t threadLabelLen;
+    bool threadNamed;               // label is set by logging_set_thread_name()
+
+    // growable buffers, reused for every record of the thread
+    char* message;
+    size_t messageSize;
+    char* record;
+    size_t recordSize;
+
+    // binary mode: entries are appended without locks
+    char* binary;
+    size_t binaryLen;
+    unsigned int binaryNamed;       // generation of the sink which has thread's name
+
+    // async mode with per-thread queues: the owner is the only producer
+    struct LogAsyncQueueS* _Atomic asyncQueue;
+    _Atomic uint64_t asyncPending;  // timestamp of the record being pushed, LOG_ASYNC_PENDING_*
+
+    // flight recorder: ring of fixed slots, written by the owner only
+    struct LogRecorderSlotS* _Atomic recorder;
+    _Atomic uint64_t recorderNext;  // sequence of the next record
+
+    // self-metrics, kept after thread exit
+    LogThreadStats stats;
+} LogThreadContext;
+
+#ifdef __linux__
+
+// workers are released together, or told to quit when not all of them could be started
+typedef struct LogBenchStartS
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    unsigned int waiting;
+    bool released;
+    bool aborted;
+} LogBenchStart;
+
+typedef struct LogBenchThreadS
+{
+    const LogBenchConfig* config;
+    LogBenchStart* start;
+    uint32_t* latencies;        // ns per call
+} LogBenchThread;
+
+typedef enum LogBinaryArgE
+{
+    LOG_ARG_INT32_E = 0,
+    LOG_ARG_INT64_E,
+    LOG_ARG_DOUBLE_E,
+    LOG_ARG_STRING_E,
+    LOG_ARG_POINTER_E,
+    LOG_ARG_MAX_E
+} LogBinaryArgEnum;
+
+typedef enum LogBinaryEntryE
+{
+    LOG_ENTRY_SITE_E = 1,   // call site description, precedes its events
+    LOG_ENTRY_EVENT_E,      // single record: site, time, thread and raw arguments
+    LOG_ENTRY_THREAD_E,     // thread name, precedes events of the named thread
+} LogBinaryEntryEnum;
+
+// call site registered on the first record, indexed by id
+typedef struct LogBinarySiteS
+{
+    const char* fmt;            // NULL for unknown id
+    const char* file;
+    int line;
+    uint32_t id;
+    uint8_t severity;
+    uint8_t argCount;           // LOG_BINARY_PREFORMATTED if arguments can't be stored
+    uint8_t args[LOG_BINARY_MAX_ARGS];
+} LogBinarySite;
+
+// thread name restored by the decoder
+typedef struct LogBinaryThreadS
+{
+    uint64_t id;
+    uint8_t labelLen;
+    char label[LOG_THREAD_LABEL_MAX];
+} LogBinaryThread;
+
+// record read by the decoder, rendered once the whole log is read
+typedef struct LogBinaryEventS
+{
+    uint64_t ns;
+    uint64_t thread;
+    size_t payload;             // offset in the log, orders records of the same time
+    uint32_t payloadLen;
+    uint32_t siteId;
+    size_t threadsCount;        // thread names known when it was written
+} LogBinaryEvent;
+
+typedef struct LogBinarySinkS
+{
+    int fd;
+    unsigned int generation;    // tells thread contexts that sink is reopened
+    pthread_mutex_t lock;       // file writes and site registration
+    uint32_t sitesCount;
+    uint8_t clock;              // FmtClockEnum of the format it's decoded with
+    LogSeverityEnum severity;   // least important severity stored
+    LogBinarySite sites[LOG_BINARY_SITES_MAX];
+} LogBinarySink;
+
+// record kept by the flight recorder: raw arguments as in binary mode
+typedef struct LogRecorderSlotS
+{
+    _Atomic uint64_t sequence;  // record sequence + 1, 0 while it's written
+    const LogSite* site;
+    uint64_t timestamp;         // ns
+    uint64_t thread;
+    uint16_t payloadLen;
+    char payload[LOG_RECORDER_SLOT_SIZE - 3 * sizeof(uint64_t) - sizeof(void*) - sizeof(uint16_t)];
+} LogRecorderSlot;
+
+_Static_assert(sizeof(LogRecorderSlot) == LOG_RECORDER_SLOT_SIZE, "unexpected recorder slot size");
+
+// dump is a binary log: it's written from a signal handler, text is rendered by the decoder
+typedef struct LogRecorderS
+{
+    size_t slots;               // per thread
+    char* format;               // header of the dump
+    uint32_t formatLen;
+    uint8_t clock;              // FmtClockEnum of the format
+    char path[LOG_FILE_PATH_MAX];
+    atomic_flag dumping;        // one dump at a time
+    struct sigaction previous[2];
+    const LogSite* dumpSites[LOG_BINARY_SITES_MAX];    // hashed, index is the id in the dump
+} LogRecorder;
+
+#ifdef LOG_URING_SUPPORTED
+
+// registered buffer: filled by records, then written in background
+typedef struct LogUringBufferS
+{
+    char* data;
+    size_t length;
+    size_t written;         // completed part, the rest is resubmitted
+    uint64_t offset;        // file offset of the first byte
+    int fd;
+    bool busy;              // in flight or taken by the sink (length is 0)
+} LogUringBuffer;
+
+// io_uring instance driven by raw syscalls, used under the file sink lock
+typedef struct LogUringS
+{
+    int ringFd;
+    bool broken;            // ring has failed: buffers are written synchronously
+
+    // rings shared with the kernel
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    _Atomic uint32_t* sqTail;
+    uint32_t* sqArray;
+    uint32_t sqMask;
+    _Atomic uint32_t* cqHead;
+    _Atomic uint32_t* cqTail;
+    struct io_uring_cqe* cqes;
+    uint32_t cqMask;
+
+    // explicit offsets: completion order doesn't change the file
+    uint64_t offset;
+    char* memory;
+    size_t bufferSize;
+    LogUringBuffer buffers[LOG_URING_BUFFERS];
+} LogUring;
+
+#endif
+
+#ifdef LOG_TSC_SUPPORTED
+
+// realtime = nsBase + (tsc - tscBase) * mult, published under seqlock
+typedef struct LogTscClockS
+{
+    atomic_uint sequence;       // odd while it's re-based
+    _Atomic uint64_t tscBase;
+    _Atomic uint64_t nsBase;
+    _Atomic uint64_t mult;      // ns per tick << LOG_TSC_SHIFT, refined by every re-base
+    uint64_t resyncTicks;
+    atomic_flag resyncing;
+    atomic_bool usable;         // invariant TSC is calibrated, set after the fields above
+} LogTscClock;
+
+#endif
+
+typedef struct LogFileSinkS
+{
+    LogFileConfig config;
+    char path[LOG_FILE_PATH_MAX];
+    
+    // guarded by lock
+    pthread_mutex_t lock;
+    int fd;
+    char* buffer;           // registered buffer of io_uring backend if it's used
+    size_t bufferLen;
+    size_t fileSize;
+    struct timespec lastFlush;
+    bool rotateRequested;
+
+    // housekeeper: timed flush and rotation off the logging threads
+    pthread_t housekeeper;
+    pthread_cond_t wakeup;
+    bool running;
+    time_t nextRotation;
+    unsigned int rotations;
+    time_t rotateRetry;     // failed rotation: size trigger waits for it
+    bool rotateFailed;      // reported once, until a rotation succeeds
+
+#ifdef LOG_URING_SUPPORTED
+    LogUring* uring;        // NULL: buffer is written by write()
+#endif
+} LogFileSink;
+
+typedef struct LogStdoutSinkS
+{
+    LogStdoutConfig config;
+
+    // guarded by lock
+    pthread_mutex_t lock;
+    char* buffer;
+    size_t bufferLen;
+    uint32_t records;
+    struct timespec firstRecord;    // realtime, deadline of the timed flush
+
+    // flusher: timed flush, started only if it's enabled
+    pthread_t flusher;
+    pthread_cond_t wakeup;
+    bool running;
+} LogStdoutSink;
+
+// logs LogStats periodically from its own thread
+typedef struct LogStatsDumperS
+{
+    uint32_t intervalMs;
+    LogSeverityEnum severity;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool running;               // guarded by lock
+} LogStatsDumper;
+
+// pre-sized file mapped into memory: records are copied to the page 
+// cache, which survives the crash of the process
+typedef struct LogMmapSegmentS
+{
+    alignas(FMT_CACHE_LINE) atomic_size_t tail;    // reserved bytes
+    alignas(FMT_CACHE_LINE) atomic_size_t committed;  // copied bytes
+    char* base;
+    size_t size;
+    int fd;
+    unsigned int index;
+    size_t used;                        // bytes reserved before it was rolled
+    struct LogMmapSegmentS* closing;    // next full segment waiting for the preparer
+    struct LogMmapSegmentS* retired;    // late writers may still read 'tail' and 'size'
+} LogMmapSegment;
+
+typedef struct LogMmapSinkS
+{
+    LogMmapSegment* _Atomic current;
+    atomic_bool failed;             // no segment to roll to: records are dropped
+
+    // guarded by rollLock
+    pthread_mutex_t rollLock;
+    LogMmapSegment* spare;          // next segment, prepared in advance
+    LogMmapSegment* closing;        // full segments, closed off the logging threads
+    LogMmapSegment* retired;        // unmapped segments, freed on close
+
+    // preparer: opens spares and closes full segments, like file housekeeper
+    pthread_t preparer;
+    pthread_cond_t wakeup;
+    bool running;
+
+    pthread_mutex_t openLock;       // nextIndex: preparer and synchronous fallback
+    char prefix[LOG_FILE_PATH_MAX];
+    size_t segmentSize;
+    unsigned int nextIndex;
+} LogMmapSink;
+
+// slot of the bounded MPMC ring (D. Vyukov's algorithm)
+typedef struct LogAsyncSlotS
+{
+    union
+    {
+        atomic_size_t sequence;     // shared ring
+        uint64_t timestamp;         // per-thread queue: merge key, ns
+    };
+    uint16_t output;
+    uint16_t severity;      // sinks might flush on important records
+    uint32_t length;
+    char record[LOG_ASYNC_SLOT_SIZE - sizeof(atomic_size_t) - 2 * sizeof(uint16_t) - sizeof(uint32_t)];
+} LogAsyncSlot;
+
+_Static_assert(sizeof(LogAsyncSlot) == LOG_ASYNC_SLOT_SIZE, "unexpected async slot size");
+#define LOG_ASYNC_SLOT_RECORD_SIZE  (sizeof(((LogAsyncSlot*)0)->record))
+
+_Static_assert(LOG_ASYNC_SLOT_RECORD_SIZE >= LOG_RECORD_INITIAL_SIZE, "async slot can't fit a common record");
+
+typedef struct LogAsyncRingS
+{
+    // producers and consumer positions live on separate cache lines
+    alignas(FMT_CACHE_LINE) atomic_size_t head;
+    alignas(FMT_CACHE_LINE) atomic_size_t tail;
+    
+    alignas(FMT_CACHE_LINE) LogAsyncSlot* slots;
+    size_t mask;
+    LogOverflowPolicyEnum policy;
+    bool perThread;         // slots are in per-thread queues, 'mask' is per queue
+
+    // writer thread
+    pthread_t writer;
+    atomic_bool running;
+    atomic_bool sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    // writer's private batches, one per output
+    char* batch[LOG_OUTPUT_ID_MAX_E];
+    size_t batchLen[LOG_OUTPUT_ID_MAX_E];
+    LogSeverityEnum batchSeverity[LOG_OUTPUT_ID_MAX_E];  // the most important one in batch
+} LogAsyncRing;
+
+// single producer queue of a thread, merged with the others by the writer
+typedef struct LogAsyncQueueS
+{
+    // producer and writer positions live on separate cache lines
+    alignas(FMT_CACHE_LINE) atomic_size_t head;
+    size_t tailCache;       // producer's last seen tail: shared line is rarely read
+    alignas(FMT_CACHE_LINE) atomic_size_t tail;
+    alignas(FMT_CACHE_LINE) LogAsyncSlot slots[];
+} LogAsyncQueue;
+
+#endif
+
 /************************************************************************
  *					P R I V A T E   D A T A								*
  ************************************************************************/
 
-FmtUnitNode* outFormats[LOG_OUTPUT_ID_MAX_E] = 
+// replaced programs are freed once no thread can be using them
+static FmtProgram* _Atomic outFormats[LOG_OUTPUT_ID_MAX_E] =
 {
     [LOG_OUTPUT_ID_STDOUT_E] = NULL,
-    [LOG_OUTPUT_ID_FILE_E] = NULL
+    [LOG_OUTPUT_ID_FILE_E] = NULL,
+    [LOG_OUTPUT_ID_MMAP_E] = NULL
+};
+
+// least important severity passed to each output
+static _Atomic LogSeverityEnum outSeverity[LOG_OUTPUT_ID_MAX_E] = 
+{
+    [LOG_OUTPUT_ID_STDOUT_E] = LOG_SEVERITY_TRACE_E,
+    [LOG_OUTPUT_ID_FILE_E] = LOG_SEVERITY_TRACE_E,
+    [LOG_OUTPUT_ID_MMAP_E] = LOG_SEVERITY_TRACE_E
+};
+
+// bit per severity accepted by at least one configured output or the flight recorder
+static atomic_uint logEnabledMask = 0;
+
+// the same for outputs only
+static atomic_uint logOutputMask = 0;
+
+// bit per FmtClockEnum used by configured formats, realtime if none has a timestamp
+static atomic_uint logClocks = 1u << FMT_CLOCK_REALTIME_E;
+
+// limits per severity, bit is set if any is configured
+static atomic_uint logLimitMask = 0;
+static atomic_uint limitSample[LOG_SEVERITY_MAX_E];         // pass 1 of N records, 0 or 1 disables
+static _Atomic uint64_t limitInterval[LOG_SEVERITY_MAX_E];  // ns per token, 0 disables bucket
+static _Atomic uint64_t limitTolerance[LOG_SEVERITY_MAX_E]; // (burst - 1) * interval
+
+// reports records dropped by limits, exempt from them
+#define LOG_SUPPRESSED_SITE(sev)                                                    \
+    [sev] =                                                                         \
+    {                                                                               \
+        .file = LOG_SITE_FILE,                                                      \
+        .fmt = "%u messages suppressed at %s:%d",                                   \
+        .line = __LINE__,                                                           \
+        .severity = sev,                                                            \
+        .state = &suppressedStates[sev],                                            \
+        .unlimited = true                                                           \
+    }
+
+// periodic self-metrics record
+#define LOG_STATS_SITE(sev)                                                         \
+    [sev] =                                                                         \
+    {                                                                               \
+        .file = LOG_SITE_FILE,                                                      \
+        .fmt = "logging stats: records %llu/%llu/%llu/%llu/%llu, suppressed %llu, " \
+               "dropped %llu, truncated %llu, bytes %llu/%llu/%llu, "               \
+               "async depth %llu, write p99 %llu/%llu/%llu ns",                     \
+        .line = __LINE__,                                                           \
+        .severity = sev,                                                            \
+        .state = &statsStates[sev],                                                 \
+        .unlimited = true                                                           \
+    }
+
+// reports a failed rotation of the log file, exempt from limits
+static LogSiteState rotationState;
+static const LogSite rotationSite =
+{
+    .file = LOG_SITE_FILE,
+    .fmt = "rotation of %s failed, errno %d, retried in %d s",
+    .line = __LINE__,
+    .severity = LOG_SEVERITY_ERROR_E,
+    .state = &rotationState,
+    .unlimited = true
+};
+
+static LogSiteState suppressedStates[LOG_SEVERITY_MAX_E];
+static const LogSite suppressedSites[LOG_SEVERITY_MAX_E] =
+{
+    LOG_SUPPRESSED_SITE(LOG_SEVERITY_ERROR_E),
+    LOG_SUPPRESSED_SITE(LOG_SEVERITY_WARN_E),
+    LOG_SUPPRESSED_SITE(LOG_SEVERITY_INFO_E),
+    LOG_SUPPRESSED_SITE(LOG_SEVERITY_DEBUG_E),
+    LOG_SUPPRESSED_SITE(LOG_SEVERITY_TRACE_E)
 };
 
+static LogSiteState statsStates[LOG_SEVERITY_MAX_E];
+static const LogSite statsSites[LOG_SEVERITY_MAX_E] =
+{
+    LOG_STATS_SITE(LOG_SEVERITY_ERROR_E),
+    LOG_STATS_SITE(LOG_SEVERITY_WARN_E),
+    LOG_STATS_SITE(LOG_SEVERITY_INFO_E),
+    LOG_STATS_SITE(LOG_SEVERITY_DEBUG_E),
+    LOG_STATS_SITE(LOG_SEVERITY_TRACE_E)
+};
+
+// program identity for the timestamp caches: address might be reused
+static atomic_uint programGeneration = 0;
+
+// direct-mapped by timestamp op address
+static _Thread_local FmtTsCache tsCache[FMT_TS_CACHE_SLOTS];
+
+// thread contexts are never freed: exited ones are reused
+static LogThreadContext* _Atomic threadContexts = NULL;
+static _Thread_local LogThreadContext* threadContext = NULL;
+
+// bumped by configuration changes to wait for readers of the replaced objects
+static _Atomic uint64_t logEpoch = 1;
+
+#ifdef __linux__
+    // not NULL while file is open
+    static LogFileSink* _Atomic fileSink = NULL;
+
+    // not NULL while stdout is batched
+    static LogStdoutSink* _Atomic stdoutSink = NULL;
+
+    // not NULL while memory-mapped segments are open
+    static LogMmapSink* _Atomic mmapSink = NULL;
+
+    // not NULL while binary mode is active
+    static LogBinarySink* _Atomic binarySink = NULL;
+    static atomic_uint binaryGeneration = 0;
+
+    static pthread_key_t threadContextKey;
+    static pthread_once_t threadContextOnce = PTHREAD_ONCE_INIT;
+
+    // not NULL while async mode is active
+    static LogAsyncRing* _Atomic asyncRing = NULL;
+
+    // not NULL while flight recorder is active
+    static LogRecorder* _Atomic flightRecorder = NULL;
+
+    // not NULL while self-metrics are dumped periodically
+    static LogStatsDumper* _Atomic statsDumper = NULL;
+    static const int recorderSignals[] = { SIGSEGV, SIGABRT };
+
+    // dump can't allocate: it runs in signal handler
+    static char recorderBuffer[LOG_BINARY_BUFFER_SIZE];
+    static size_t recorderBufferLen;
+
+#ifdef LOG_TSC_SUPPORTED
+    // calibrated once, when TSC clock is first selected
+    static LogTscClock tscClock = { .resyncing = ATOMIC_FLAG_INIT };
+    static pthread_once_t tscClockOnce = PTHREAD_ONCE_INIT;
+#endif
+
+    // benchmark: the same call site for every thread
+    static const char* benchSinks[LOG_BENCH_SINK_MAX_E] = { "null", "pipe", "file", "mmap" };
+    static LogSiteState benchSiteState;
+    static const LogSite benchSite = 
+    {
+        .file = LOG_SITE_FILE,
+        .fmt = "bench %u %s",
+        .line = __LINE__,
+        .severity = LOG_SEVERITY_INFO_E,
+        .state = &benchSiteState
+    };
+#endif
+
 
 /************************************************************************
  *                  F U N C T I O N S   P R O T O T Y P E S             *
@@ -226,17 +1155,180 @@ FmtUnitNode* outFormats[LOG_OUTPUT_ID_MAX_E] =
 
 // public functions
 bool logging_set_format(LogOutputIdEnum output, const char* format);
+bool logging_set_severity(LogOutputIdEnum output, LogSeverityEnum severity);
+bool logging_set_limit(LogSeverityEnum severity, uint32_t ratePerSec, uint32_t burst, uint32_t sampleEvery);
+bool logging_set_thread_name(const char* name);
+bool logging_open_file(const LogFileConfig* config);
+void logging_close_file();
+bool logging_start_stdout_batch(const LogStdoutConfig* config);
+void logging_stop_stdout_batch();
+bool logging_open_mmap(const char* prefix, size_t segmentSize);
+void logging_close_mmap();
+bool logging_open_binary(const char* path, const char* format, LogSeverityEnum severity);
+void logging_close_binary();
+int logging_decode_binary(const char* path);
 void logging_destroy();
-void write_log(LogSeverityEnum severity, const char* file, int line, const char* fmt, ...);
+bool logging_start_async(size_t capacity, LogOverflowPolicyEnum policy);
+bool logging_start_async_per_thread(size_t capacity, LogOverflowPolicyEnum policy);
+void logging_stop_async();
+bool logging_start_recorder(const char* path, const char* format, size_t slots);
+void logging_stop_recorder();
+bool logging_dump_recorder();
+bool logging_get_stats(LogStats* stats);
+bool logging_start_stats_dump(uint32_t intervalMs, LogSeverityEnum severity);
+void logging_stop_stats_dump();
+bool logging_parse_benchmark(int argc, char** argv, LogBenchConfig* config);
+int logging_benchmark(const LogBenchConfig* config);
+void write_log(const LogSite* site, const char* format, ...);
 
 // log record functions
-static size_t log_record_format(LogOutputIdEnum output, char* buffer, size_t buffSize, LogSeverityEnum severity, const char* file, int line, const char* fmt, va_list args);
-static void log_record_write(LogOutputIdEnum output, const char* record, size_t recordLen);
+static void log_update_enabled_mask();
+static void log_update_clock();
+static const char* log_site_file(const LogSite* site);
+static bool log_site_pass(const LogSite* site, uint32_t* suppressed);
+static const uint8_t* log_site_signature(const LogSite* site, uint8_t* args, uint8_t* argCount);
+static uint64_t log_limit_clock();
+static void log_record_clock(unsigned int clock, struct timespec* now);
+static uint64_t log_record_clocks(unsigned int clocks, struct timespec* stamps);
+#ifdef LOG_TSC_SUPPORTED
+    static void log_tsc_calibrate();
+    static void log_tsc_resync(uint64_t tsc);
+    static void log_tsc_clock(struct timespec* now);
+    static uint64_t log_tsc_scale(uint64_t ticks, uint64_t mult);
+#endif
+static bool log_buffer_reserve(char** buffer, size_t* size, size_t required);
+static size_t log_record_render(LogThreadContext* context, const FmtProgram* program, const LogRecord* record);
+static size_t log_record_format(const FmtProgram* program, char* buffer, size_t buffSize, const LogRecord* record);
+static void log_record_write(LogOutputIdEnum output, LogSeverityEnum severity, const char* record, size_t recordLen);
+static void log_stats_write(LogThreadContext* context, LogOutputIdEnum output, LogSeverityEnum severity, const char* record, size_t recordLen);
+#ifdef __linux__
+    static uint64_t log_stats_percentile(const uint64_t* buckets, unsigned int permille);
+    static void log_stats_dump(LogSeverityEnum severity);
+    static void* log_stats_dumper(void* arg);
+#endif
+static char* log_record_copy(char* position, const char* end, const char* source, size_t length);
+static char* log_record_fill(char* position, const char* end, char symbol, size_t count);
+static size_t log_record_decimal(char* buffer, uint64_t value);
+static char* log_record_unit(const char* pool, const FmtOp* op, char* position, const char* end, const char* value, size_t valueLen);
+static char* log_record_escape(char* position, const char* end, const char* value, size_t valueLen, uint8_t flags);
+
+// file sink functions
+#ifdef __linux__
+    static bool log_write_all(int fd, const char* data, size_t length);
+    static void log_file_flush_locked(LogFileSink* sink);
+    static void log_file_write(LogFileSink* sink, LogSeverityEnum severity, const char* record, size_t recordLen);
+    static bool log_file_rotate(LogFileSink* sink, time_t now);
+    static time_t log_file_next_rotation(const LogFileSink* sink, time_t now);
+    static void* log_file_housekeeper(void* arg);
+    static int log_file_open(LogFileSink* sink);
+    static void log_file_write_direct(LogFileSink* sink, const char* data, size_t length);
+#endif
+
+// io_uring backend functions
+#ifdef LOG_URING_SUPPORTED
+    static LogUring* log_uring_open(size_t bufferSize);
+    static void log_uring_close(LogUring* uring);
+    static bool log_pwrite_all(int fd, const char* data, size_t length, uint64_t offset);
+    static bool log_uring_push(LogUring* uring, unsigned int index);
+    static bool log_uring_enter(LogUring* uring, unsigned int submit, unsigned int complete);
+    static void log_uring_reap(LogUring* uring);
+    static void log_uring_wait(LogUring* uring, bool all);
+    static char* log_uring_write(LogUring* uring, char* data, size_t length, int fd);
+#endif
+
+// stdout sink functions
+#ifdef __linux__
+    static bool log_writev_all(int fd, struct iovec* vector, int count);
+    static void log_stdout_write(LogStdoutSink* sink, LogSeverityEnum severity, const char* record, size_t recordLen);
+    static void* log_stdout_flusher(void* arg);
+#endif
+
+// memory-mapped sink functions
+#ifdef __linux__
+    static LogMmapSegment* log_mmap_segment_open(LogMmapSink* sink);
+    static void log_mmap_segment_close(LogMmapSegment* segment, size_t used);
+    static void log_mmap_segment_retire(LogMmapSink* sink, LogMmapSegment* segment);
+    static void log_mmap_roll(LogMmapSink* sink, LogMmapSegment* full, size_t used);
+    static void log_mmap_write(LogMmapSink* sink, const char* record, size_t recordLen);
+    static void* log_mmap_preparer(void* arg);
+#endif
+
+// thread context functions
+static LogThreadContext* log_thread_context();
+static void log_thread_label(LogThreadContext* context);
+static bool log_epoch_enter(LogThreadContext* context);
+static void log_epoch_exit(LogThreadContext* context, bool entered);
+static void log_epoch_synchronize();
+#ifdef __linux__
+    static void log_thread_context_key();
+    static void log_thread_exit(void* arg);
+#endif
+
+// benchmark functions
+#ifdef __linux__
+    static void* log_bench_worker(void* arg);
+    static void* log_bench_drain(void* arg);
+    static int log_bench_compare(const void* first, const void* second);
+    static uint32_t log_bench_percentile(const uint32_t* sorted, size_t count, double rank);
+    static bool log_bench_number(const char* text, size_t max, size_t* value);
+#endif
+
+// binary mode functions
+#ifdef __linux__
+    static const char* log_binary_scan_spec(const char* spec, uint8_t* args, size_t* argCount, size_t maxArgs);
+    static bool log_binary_signature(const char* fmt, uint8_t* args, uint8_t* argCount);
+    static LogBinarySite* log_binary_site(LogBinarySink* sink, const LogSite* site);
+    static void log_binary_flush(LogBinarySink* sink, LogThreadContext* context);
+    static char* log_binary_encode(const char* fmt, const uint8_t* args, uint8_t argCount, va_list values, char* position, const char* end);
+    static void log_binary_write(LogBinarySink* sink, LogThreadContext* context, const LogSite* site, va_list args);
+    static size_t log_binary_render(const LogBinarySite* site, const char* payload, size_t payloadLen, char* buffer, size_t bufSize);
+    static int log_binary_event_compare(const void* left, const void* right);
+#endif
+
+// flight recorder functions
+#ifdef __linux__
+    static void log_recorder_write(LogRecorder* recorder, LogThreadContext* context, const LogSite* site, va_list args);
+    static bool log_recorder_read(const LogRecorderSlot* slot, uint64_t sequence, LogRecorderSlot* copy);
+    static bool log_recorder_dump(LogRecorder* recorder);
+    static void log_recorder_append(int fd, const void* data, size_t length);
+    static bool log_recorder_site(LogRecorder* recorder, int fd, const LogSite* site, uint32_t* id);
+    static void log_recorder_signal(int signal);
+#endif
 
-// node list funtions
-static bool get_timestamp(char* format, char* buffer, size_t bufSize, size_t* written);
-static void fmt_push_single_node(FmtUnitNode* node, LogOutputIdEnum output);
+// async mode functions
+#ifdef __linux__
+    static bool log_async_start(size_t capacity, LogOverflowPolicyEnum policy, bool perThread);
+    static bool log_async_push(LogAsyncRing* ring, LogThreadContext* context, LogOutputIdEnum output, LogSeverityEnum severity, const char* record, size_t recordLen);
+    static bool log_async_pop(LogAsyncRing* ring, LogAsyncSlot* out);
+    static bool log_async_queue_push(LogAsyncRing* ring, LogThreadContext* context, LogOutputIdEnum output, LogSeverityEnum severity, 
+                                     uint64_t timestamp, const char* record, size_t recordLen);
+    static char* log_async_spill(const char* record, size_t recordLen);
+    static void log_async_release(LogAsyncSlot* slot);
+    static void log_async_flush_batch(LogAsyncRing* ring, LogOutputIdEnum output);
+    static void log_async_consume(LogAsyncRing* ring, LogAsyncSlot* slot);
+    static size_t log_async_drain(LogAsyncRing* ring);
+    static size_t log_async_drain_merged(LogAsyncRing* ring);
+    static size_t log_async_depth(LogAsyncRing* ring);
+    static void* log_async_writer(void* arg);
+    static void log_async_free(LogAsyncRing* ring);
+#endif
+
+// format program functions
+static size_t get_timestamp(const FmtProgram* program, const FmtOp* op, const struct timespec* now, char* buffer, size_t bufSize);
+static uint8_t fmt_timestamp_split(const char* option, size_t length, size_t* mainLen);
+static FmtClockEnum fmt_timestamp_clock(const char* option, size_t length, size_t* mainLen);
+static bool fmt_builder_push_string(FmtProgramBuilder* builder, const char* string, size_t length, uint32_t* offset);
+static bool fmt_builder_intern_string(FmtProgramBuilder* builder, const char* string, size_t length, uint32_t* offset);
+static bool fmt_builder_push_op(FmtProgramBuilder* builder, const FmtOp* op);
+static void fmt_builder_free(FmtProgramBuilder* builder);
+static FmtProgram* fmt_program_build(const FmtProgramBuilder* builder);
+static FmtProgram* fmt_compile(const char* format, bool colorless);
+static bool fmt_prerender_severities(FmtProgramBuilder* builder, FmtOp* op);
 static bool fmt_push_nodes(void* arg);
+static bool fmt_push_fields(void* arg);
+static bool fmt_push_fields_end(FmtProgramBuilder* builder);
+static bool fmt_output_is_terminal(LogOutputIdEnum output);
+static size_t fmt_strip_colors(const char* string, size_t length, char* buffer);
 
 // fmt parser functions
 static FmtUnitsEnum fmt_find_unit(const char* string, size_t length);
@@ -263,342 +1355,5394 @@ bool logging_set_format(LogOutputIdEnum output, const char* format)
 
     do
     {
-        if ((output != LOG_OUTPUT_ID_STDOUT_E) && (output != LOG_OUTPUT_ID_FILE_E))
+        if (output >= LOG_OUTPUT_ID_MAX_E)
         {
             break;
         }
 
-        if (!format || !strlen(format))
+        // colors are resolved once here, not on every record;
+        // previously set format stays untouched in case of failure
+        FmtProgram* program = fmt_compile(format, !fmt_output_is_terminal(output));
+        if (program == NULL)
         {
             break;
         }
 
-        FmtParser parser = 
+        // readers see either the old or the new program, 
+        // the old one is freed after all of them are done
+        FmtProgram* replaced = atomic_exchange(&outFormats[output], program);
+        log_update_enabled_mask();
+        if (replaced != NULL)
         {
-            .output = output,
-            .parsed = false,
-            .callback = fmt_push_nodes,
-            .currentState = FMT_PARSE_GAP,
-            .string = format,
-            .index = 0,
-            .currentBuff = { 0 },
-            .accumulateBuff = { 0 },
-            .currentIndex = 0,      
-            .accumulateIndex = 0,
-            .unit = FMT_UNIT_MAX_E,
-            .align = 0,
-            .color = NULL,
-            .extOption = { 0 }
-        };
-        
-        fmt_parse_format(&parser);
-        result = parser.parsed;
+            log_epoch_synchronize();
+            aligned_free(replaced);
+        }
+        result = true;
 
     } while (0);
 
-    if (!result)
+    return result;
+}
+
+bool logging_set_severity(LogOutputIdEnum output, LogSeverityEnum severity)
+{
+    if ((output >= LOG_OUTPUT_ID_MAX_E) || (severity >= LOG_SEVERITY_MAX_E))
     {
-        // some nodes might be created befor failure
-        logging_destroy();
+        return false;
     }
 
-    return result;
+    atomic_store(&outSeverity[output], severity);
+    log_update_enabled_mask();
+
+    return true;
 }
 
-void logging_destroy()
+bool logging_set_limit(LogSeverityEnum severity, uint32_t ratePerSec, uint32_t burst, uint32_t sampleEvery)
 {
-    for (int output = 0; output < 2; ++output)
+    if (severity >= LOG_SEVERITY_MAX_E)
     {
-        FmtUnitNode* curr = outFormats[output];
-        FmtUnitNode* temp;
+        return false;
+    }
 
-        while (curr != NULL)
-        {
-            if (curr->color != NULL)
-            {
-                free(curr->color);
-            }
-            
-            temp = curr->next;
-            free(curr);
-            curr = temp;
-        };
+    // every call site of the severity has its own bucket
+    uint64_t interval = ratePerSec ? (1000000000ull / ratePerSec) : 0;
+    uint64_t tolerance = (burst > 1) ? (uint64_t)(burst - 1) * interval : 0;
+    atomic_store(&limitSample[severity], sampleEvery);
+    atomic_store(&limitInterval[severity], interval);
+    atomic_store(&limitTolerance[severity], tolerance);
 
-        outFormats[output] = NULL;
+    if ((sampleEvery > 1) || interval)
+    {
+        atomic_fetch_or(&logLimitMask, 1u << severity);
     }
+    else
+    {
+        atomic_fetch_and(&logLimitMask, ~(1u << severity));
+    }
+
+    return true;
 }
 
-void write_log(LogSeverityEnum severity, const char* file, int line, const char* fmt, ...)
+bool logging_set_thread_name(const char* name)
 {
-    va_list args = { 0 };
-	va_start(args, fmt);
+    bool result = false;
 
-    for (LogOutputIdEnum output = LOG_OUTPUT_ID_STDOUT_E; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    do
     {
-        char record[LOG_RECORD_MAX_SIZE] = { 0 };
-        size_t formatted = log_record_format(output, record, sizeof(record) - 1, severity, file, line, fmt, args);
-        if (formatted)
+        LogThreadContext* context = log_thread_context();
+        if (context == NULL)
         {
-            log_record_write(output, record, formatted);
+            break;
         }
-    }
 
-    va_end(args);
-}
+        if (name == NULL)
+        {
+            // back to the thread id
+            log_thread_label(context);
+            result = true;
+            break;
+        }
 
-/************************************************************************
- *					S T A T I C   F U N C T I O N S     				*
- ************************************************************************/
+        size_t nameLen = strlen(name);
+        if ((nameLen == 0) || (nameLen >= LOG_THREAD_LABEL_MAX))
+        {
+            break;
+        }
+
+        memcpy(context->threadLabel, name, nameLen);
+        context->threadLabelLen = (uint8_t)nameLen;
+        context->threadNamed = true;
+        context->binaryNamed = 0;
+        result = true;
+    } while (0);
+
+    return result;
+}
 
-size_t log_record_format(LogOutputIdEnum output, char* buffer, size_t buffSize, LogSeverityEnum severity, const char* file, int line, const char* fmt, va_list args)
+bool logging_open_file(const LogFileConfig* config)
 {
-    FmtUnitNode* fmtNode = outFormats[output];
-    size_t written = 0;
-    size_t sizeAvailable = buffSize;
-    
-    while (fmtNode != NULL)
-    {
-        // required for all units
-        char* bufPosition = buffer + written;
-        sizeAvailable = buffSize - written;
-        int result = 0;
-        
-        // create format string
-        char unitFmt[32] = { 0 };
-        const char* color = fmtNode->color ? fmtNode->color : "";
-        const char* reset = fmtNode->color ? "\033[m" : "";
-        result = snprintf(unitFmt, sizeof(unitFmt), "%s%c%li%c%s", color, '%', fmtNode->alignment, 's', reset);
-        if (result == -1)
-            continue;
+    bool result = false;
 
-        switch (fmtNode->unit)
+#ifdef __linux__
+    LogFileSink* sink = NULL;
+    bool lockReady = false;
+
+    do
+    {
+        if ((config == NULL) || (config->path == NULL))
         {
-            case FMT_UNIT_MAX_E:
-            {
-                _S("FMT_UNIT_MAX_E");
+            break;
+        }
 
-                result = snprintf(bufPosition, sizeAvailable, "%s", fmtNode->gap);           
-                if (result != -1)
-                    written += result;
-            }
+        size_t pathLen = strlen(config->path);
+        if ((pathLen == 0) || (pathLen >= LOG_FILE_PATH_MAX))
+        {
             break;
+        }
 
-            case FMT_FILENAME_E:
-            {
-                _S("FMT_FILENAME_E");
+        if (atomic_load(&fileSink) != NULL)
+        {
+            // already opened
+            break;
+        }
 
-                result = snprintf(bufPosition, sizeAvailable, unitFmt, file);
-                if (result != -1)
-                    written += result;
-            }
+        sink = (LogFileSink*)calloc(1, sizeof(LogFileSink));
+        if (sink == NULL)
+        {
             break;
+        }
 
-            case FMT_LINE_E:
-            {
-                _S("FMT_LINE_E");
+        sink->fd = -1;
+        sink->config = *config;
+        memcpy(sink->path, config->path, pathLen + 1);
+        sink->config.path = sink->path;
+        if (sink->config.bufferSize == 0)
+        {
+            sink->config.bufferSize = LOG_FILE_BUFFER_DEFAULT;
+        }
 
-                char lineString[8] = { 0 };
-                (void) snprintf(lineString, sizeof(lineString), "%i", line);
-                result = snprintf(bufPosition, sizeAvailable, unitFmt, lineString);
-                if (result != -1)
-                    written += result;
-            }
-            break;            
+    #ifdef LOG_URING_SUPPORTED
+        // silently falls back to write() if io_uring is unavailable
+        sink->uring = sink->config.uring ? log_uring_open(sink->config.bufferSize) : NULL;
+        if (sink->uring != NULL)
+        {
+            sink->buffer = sink->uring->buffers[0].data;
+        }
+        else
+    #endif
+        {
+            sink->buffer = (char*)malloc(sink->config.bufferSize);
+        }
 
-            case FMT_THREAD_E:
+        if (sink->buffer == NULL)
+        {
+            break;
+        }
+
+        sink->fd = log_file_open(sink);
+        if (sink->fd == -1)
+        {
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &sink->lastFlush);
+        sink->nextRotation = log_file_next_rotation(sink, time(NULL));
+        sink->running = true;
+
+        pthread_mutex_init(&sink->lock, NULL);
+        pthread_cond_init(&sink->wakeup, NULL);
+        lockReady = true;
+
+        if (pthread_create(&sink->housekeeper, NULL, log_file_housekeeper, sink) != 0)
+        {
+            break;
+        }
+
+        atomic_store(&fileSink, sink);
+        log_update_enabled_mask();
+        result = true;
+    } while (0);
+
+    if (!result && (sink != NULL))
+    {
+        if (lockReady)
+        {
+            pthread_mutex_destroy(&sink->lock);
+            pthread_cond_destroy(&sink->wakeup);
+        }
+
+        if (sink->fd != -1)
+        {
+            close(sink->fd);
+        }
+
+    #ifdef LOG_URING_SUPPORTED
+        if (sink->uring != NULL)
+        {
+            log_uring_close(sink->uring);
+            sink->buffer = NULL;
+        }
+    #endif
+
+        free(sink->buffer);
+        free(sink);
+    }
+#else
+    (void)config;
+#endif
+
+    return result;
+}
+
+void logging_close_file()
+{
+#ifdef __linux__
+    LogFileSink* sink = atomic_exchange(&fileSink, NULL);
+    if (sink == NULL)
+    {
+        return;
+    }
+
+    // logging threads might still be writing
+    log_update_enabled_mask();
+    log_epoch_synchronize();
+
+    pthread_mutex_lock(&sink->lock);
+    sink->running = false;
+    pthread_cond_signal(&sink->wakeup);
+    pthread_mutex_unlock(&sink->lock);
+    pthread_join(sink->housekeeper, NULL);
+
+    log_file_flush_locked(sink);
+
+#ifdef LOG_URING_SUPPORTED
+    if (sink->uring != NULL)
+    {
+        // waits for the writes in flight
+        log_uring_close(sink->uring);
+        sink->buffer = NULL;
+    }
+#endif
+
+    close(sink->fd);
+
+    pthread_mutex_destroy(&sink->lock);
+    pthread_cond_destroy(&sink->wakeup);
+    free(sink->buffer);
+    free(sink);
+#endif
+}
+
+bool logging_start_stdout_batch(const LogStdoutConfig* config)
+{
+    bool result = false;
+
+#ifdef __linux__
+    LogStdoutSink* sink = NULL;
+    bool lockReady = false;
+
+    do
+    {
+        if (config == NULL)
+        {
+            break;
+        }
+
+        if (atomic_load(&stdoutSink) != NULL)
+        {
+            // already started
+            break;
+        }
+
+        sink = (LogStdoutSink*)calloc(1, sizeof(LogStdoutSink));
+        if (sink == NULL)
+        {
+            break;
+        }
+
+        sink->config = *config;
+        if (sink->config.bufferSize == 0)
+        {
+            sink->config.bufferSize = LOG_STDOUT_BUFFER_DEFAULT;
+        }
+
+        sink->buffer = (char*)malloc(sink->config.bufferSize);
+        if (sink->buffer == NULL)
+        {
+            break;
+        }
+
+        sink->running = true;
+        pthread_mutex_init(&sink->lock, NULL);
+        pthread_cond_init(&sink->wakeup, NULL);
+        lockReady = true;
+
+        if (sink->config.flushIntervalMs && (pthread_create(&sink->flusher, NULL, log_stdout_flusher, sink) != 0))
+        {
+            break;
+        }
+
+        atomic_store(&stdoutSink, sink);
+        result = true;
+    } while (0);
+
+    if (!result && (sink != NULL))
+    {
+        if (lockReady)
+        {
+            pthread_mutex_destroy(&sink->lock);
+            pthread_cond_destroy(&sink->wakeup);
+        }
+
+        free(sink->buffer);
+        free(sink);
+    }
+#else
+    (void)config;
+#endif
+
+    return result;
+}
+
+void logging_stop_stdout_batch()
+{
+#ifdef __linux__
+    LogStdoutSink* sink = atomic_exchange(&stdoutSink, NULL);
+    if (sink == NULL)
+    {
+        return;
+    }
+
+    // logging threads might still be writing
+    log_epoch_synchronize();
+
+    if (sink->config.flushIntervalMs)
+    {
+        pthread_mutex_lock(&sink->lock);
+        sink->running = false;
+        pthread_cond_signal(&sink->wakeup);
+        pthread_mutex_unlock(&sink->lock);
+        pthread_join(sink->flusher, NULL);
+    }
+
+    (void)log_write_all(STDOUT_FILENO, sink->buffer, sink->bufferLen);
+
+    pthread_mutex_destroy(&sink->lock);
+    pthread_cond_destroy(&sink->wakeup);
+    free(sink->buffer);
+    free(sink);
+#endif
+}
+
+bool logging_open_mmap(const char* prefix, size_t segmentSize)
+{
+    bool result = false;
+
+#ifdef __linux__
+    LogMmapSink* sink = NULL;
+
+    do
+    {
+        if ((prefix == NULL) || (strlen(prefix) == 0) || (strlen(prefix) >= LOG_FILE_PATH_MAX))
+        {
+            break;
+        }
+
+        if (atomic_load(&mmapSink) != NULL)
+        {
+            // already opened
+            break;
+        }
+
+        sink = (LogMmapSink*)calloc(1, sizeof(LogMmapSink));
+        if (sink == NULL)
+        {
+            break;
+        }
+
+        // segment is mapped by whole pages
+        long pageSize = sysconf(_SC_PAGESIZE);
+        segmentSize = segmentSize ? segmentSize : LOG_MMAP_SEGMENT_DEFAULT;
+        sink->segmentSize = FMT_ROUND_UP(segmentSize, (size_t)pageSize);
+        strcpy(sink->prefix, prefix);
+        pthread_mutex_init(&sink->rollLock, NULL);
+        pthread_mutex_init(&sink->openLock, NULL);
+        pthread_cond_init(&sink->wakeup, NULL);
+
+        LogMmapSegment* first = log_mmap_segment_open(sink);
+        atomic_init(&sink->current, first);
+        atomic_init(&sink->failed, false);
+
+        // the first spare is prepared in background as well
+        sink->running = true;
+        if ((first == NULL) || (pthread_create(&sink->preparer, NULL, log_mmap_preparer, sink) != 0))
+        {
+            if (first != NULL)
+            {
+                char name[LOG_MMAP_NAME_MAX];
+                snprintf(name, sizeof(name), "%s.%06u", sink->prefix, first->index);
+                log_mmap_segment_close(first, 0);
+                unlink(name);
+                aligned_free(first);
+            }
+
+            pthread_mutex_destroy(&sink->rollLock);
+            pthread_mutex_destroy(&sink->openLock);
+            pthread_cond_destroy(&sink->wakeup);
+            break;
+        }
+
+        atomic_store(&mmapSink, sink);
+        log_update_enabled_mask();
+        result = true;
+    } while (0);
+
+    if (!result && (sink != NULL))
+    {
+        free(sink);
+    }
+#else
+    (void)prefix;
+    (void)segmentSize;
+#endif
+
+    return result;
+}
+
+void logging_close_mmap()
+{
+#ifdef __linux__
+    LogMmapSink* sink = atomic_exchange(&mmapSink, NULL);
+    if (sink == NULL)
+    {
+        return;
+    }
+
+    // logging threads might still be writing
+    log_update_enabled_mask();
+    log_epoch_synchronize();
+
+    // no more rolls: preparer closes the full segments and exits
+    pthread_mutex_lock(&sink->rollLock);
+    sink->running = false;
+    pthread_cond_signal(&sink->wakeup);
+    pthread_mutex_unlock(&sink->rollLock);
+    pthread_join(sink->preparer, NULL);
+
+    // cut unused tail so that file contains records only
+    LogMmapSegment* current = atomic_load(&sink->current);
+    log_mmap_segment_close(current, atomic_load(&current->committed));
+    log_mmap_segment_retire(sink, current);
+
+    if (sink->spare != NULL)
+    {
+        // spare has never been used
+        char name[LOG_MMAP_NAME_MAX];
+        snprintf(name, sizeof(name), "%s.%06u", sink->prefix, sink->spare->index);
+        log_mmap_segment_close(sink->spare, 0);
+        unlink(name);
+        log_mmap_segment_retire(sink, sink->spare);
+    }
+
+    while (sink->retired != NULL)
+    {
+        LogMmapSegment* next = sink->retired->retired;
+        aligned_free(sink->retired);
+        sink->retired = next;
+    }
+
+    pthread_mutex_destroy(&sink->rollLock);
+    pthread_mutex_destroy(&sink->openLock);
+    pthread_cond_destroy(&sink->wakeup);
+    free(sink);
+#endif
+}
+
+bool logging_open_binary(const char* path, const char* format, LogSeverityEnum severity)
+{
+    bool result = false;
+
+#ifdef __linux__
+    LogBinarySink* sink = NULL;
+
+    do
+    {
+        if ((path == NULL) || (format == NULL) || (strlen(format) == 0) || (strlen(format) > UINT32_MAX) ||
+            (severity < LOG_SEVERITY_ERROR_E) || (severity >= LOG_SEVERITY_MAX_E))
+        {
+            break;
+        }
+
+        if (atomic_load(&binarySink) != NULL)
+        {
+            // already opened
+            break;
+        }
+
+        // compiled here only to validate it and find its clock
+        FmtProgram* program = fmt_compile(format, true);
+        if (program == NULL)
+        {
+            break;
+        }
+        uint8_t clock = program->clock;
+        aligned_free(program);
+
+        sink = (LogBinarySink*)calloc(1, sizeof(LogBinarySink));
+        if (sink == NULL)
+        {
+            break;
+        }
+        sink->clock = clock;
+        sink->severity = severity;
+
+        sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, LOG_FILE_MODE);
+        if (sink->fd == -1)
+        {
+            break;
+        }
+
+        // header: magic, length of the text format and the format itself
+        uint32_t formatLen = (uint32_t)strlen(format);
+        bool written = log_write_all(sink->fd, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) &&
+                       log_write_all(sink->fd, (const char*)&formatLen, sizeof(formatLen)) &&
+                       log_write_all(sink->fd, format, formatLen);
+        if (!written)
+        {
+            break;
+        }
+
+        pthread_mutex_init(&sink->lock, NULL);
+        sink->generation = atomic_fetch_add(&binaryGeneration, 1) + 1;
+        atomic_store(&binarySink, sink);
+        log_update_enabled_mask();
+        result = true;
+    } while (0);
+
+    if (!result && (sink != NULL))
+    {
+        if (sink->fd != -1)
+        {
+            close(sink->fd);
+        }
+        free(sink);
+    }
+#else
+    (void)path;
+    (void)format;
+    (void)severity;
+#endif
+
+    return result;
+}
+
+void logging_close_binary()
+{
+#ifdef __linux__
+    LogBinarySink* sink = atomic_exchange(&binarySink, NULL);
+    if (sink == NULL)
+    {
+        return;
+    }
+
+    // after that thread buffers have no writers
+    log_update_enabled_mask();
+    log_epoch_synchronize();
+
+    for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        log_binary_flush(sink, context);
+        free(context->binary);
+        context->binary = NULL;
+    }
+
+    close(sink->fd);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink);
+#endif
+}
+
+int logging_decode_binary(const char* path)
+{
+    int result = -1;
+
+#ifdef __linux__
+    char* data = NULL;
+    FmtProgram* program = NULL;
+    LogBinarySite* sites = NULL;
+    LogBinaryThread* threads = NULL;
+    size_t threadsCount = 0;
+    LogBinaryEvent* events = NULL;
+    size_t eventsCount = 0;
+    size_t eventsCapacity = 0;
+    FILE* input = fopen(path, "rb");
+
+    do
+    {
+        if (input == NULL)
+        {
+            break;
+        }
+
+        fseek(input, 0, SEEK_END);
+        long size = ftell(input);
+        fseek(input, 0, SEEK_SET);
+        if (size < (long)(LOG_BINARY_MAGIC_LEN + sizeof(uint32_t)))
+        {
+            break;
+        }
+
+        data = (char*)malloc((size_t)size + 1);
+        if ((data == NULL) || (fread(data, 1, (size_t)size, input) != (size_t)size))
+        {
+            break;
+        }
+        data[size] = '\0';
+
+        if (memcmp(data, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) != 0)
+        {
+            printf("ERROR = not a binary log\n");
+            break;
+        }
+
+        // the same format program as in text mode renders the records
+        uint32_t formatLen;
+        memcpy(&formatLen, data + LOG_BINARY_MAGIC_LEN, sizeof(formatLen));
+        size_t position = LOG_BINARY_MAGIC_LEN + sizeof(formatLen);
+        if (formatLen > ((size_t)size - position))
+        {
+            break;
+        }
+
+        // rendered with its own program: caller's stdout format stays untouched
+        char* format = strndup(data + position, formatLen);
+        program = (format != NULL) ? fmt_compile(format, !fmt_output_is_terminal(LOG_OUTPUT_ID_STDOUT_E)) : NULL;
+        free(format);
+        if (program == NULL)
+        {
+            break;
+        }
+        position += formatLen;
+
+        // input isn't trusted: every read is checked against the bytes left
+        size_t sitesCapacity = 0;
+        bool valid = true;
+        while (valid && (position < (size_t)size))
+        {
+            uint8_t kind = (uint8_t)data[position];
+            ++position;
+            size_t remaining = (size_t)size - position;
+
+            if (kind == LOG_ENTRY_SITE_E)
+            {
+                // id, severity, line, file, fmt (both null-terminated), argCount, args
+                LogBinarySite site = { 0 };
+                uint32_t line;
+                valid = (remaining >= 9);
+                if (!valid)
+                {
+                    break;
+                }
+
+                memcpy(&site.id, data + position, sizeof(site.id));
+                site.severity = (uint8_t)data[position + 4];
+                memcpy(&line, data + position + 5, sizeof(line));
+                site.line = (int)line;
+                position += 9;
+
+                // writer never has more sites
+                valid = (site.id < LOG_BINARY_SITES_MAX) && (site.severity < LOG_SEVERITY_MAX_E);
+                if (!valid)
+                {
+                    break;
+                }
+
+                const char* fileEnd = (const char*)memchr(data + position, '\0', (size_t)size - position);
+                valid = (fileEnd != NULL);
+                if (!valid)
+                {
+                    break;
+                }
+                site.file = data + position;
+                position = (size_t)(fileEnd - data) + 1;
+
+                const char* fmtEnd = (const char*)memchr(data + position, '\0', (size_t)size - position);
+                valid = (fmtEnd != NULL) && ((size_t)(fmtEnd - data) + 1 < (size_t)size);
+                if (!valid)
+                {
+                    break;
+                }
+                site.fmt = data + position;
+                position = (size_t)(fmtEnd - data) + 1;
+
+                site.argCount = (uint8_t)data[position];
+                ++position;
+                if (site.argCount != LOG_BINARY_PREFORMATTED)
+                {
+                    valid = (site.argCount <= LOG_BINARY_MAX_ARGS) && (site.argCount <= ((size_t)size - position));
+                    if (!valid)
+                    {
+                        break;
+                    }
+                    memcpy(site.args, data + position, site.argCount);
+                    position += site.argCount;
+                }
+
+                if (site.id >= sitesCapacity)
+                {
+                    size_t capacity = sitesCapacity ? sitesCapacity : 64;
+                    while ((capacity <= site.id) && (capacity <= (SIZE_MAX / (2 * sizeof(LogBinarySite)))))
+                    {
+                        capacity *= 2;
+                    }
+
+                    LogBinarySite* grown = (capacity > site.id) ? (LogBinarySite*)realloc(sites, capacity * sizeof(LogBinarySite)) : NULL;
+                    valid = (grown != NULL);
+                    if (valid)
+                    {
+                        memset(grown + sitesCapacity, 0, (capacity - sitesCapacity) * sizeof(LogBinarySite));
+                        sites = grown;
+                        sitesCapacity = capacity;
+                    }
+                }
+
+                if (valid)
+                {
+                    sites[site.id] = site;
+                }
+            }
+            else if (kind == LOG_ENTRY_THREAD_E)
+            {
+                // thread id, label length, label
+                LogBinaryThread thread = { 0 };
+                valid = (remaining >= 9);
+                if (!valid)
+                {
+                    break;
+                }
+
+                memcpy(&thread.id, data + position, sizeof(thread.id));
+                thread.labelLen = (uint8_t)data[position + 8];
+                position += 9;
+
+                valid = (thread.labelLen < LOG_THREAD_LABEL_MAX) && (thread.labelLen <= ((size_t)size - position));
+                if (valid)
+                {
+                    memcpy(thread.label, data + position, thread.labelLen);
+                    position += thread.labelLen;
+
+                    LogBinaryThread* grown = (LogBinaryThread*)realloc(threads, (threadsCount + 1) * sizeof(LogBinaryThread));
+                    valid = (grown != NULL);
+                    if (valid)
+                    {
+                        threads = grown;
+                        threads[threadsCount++] = thread;
+                    }
+                }
+            }
+            else if (kind == LOG_ENTRY_EVENT_E)
+            {
+                // site id, timestamp in ns, thread, payload length, payload
+                uint32_t siteId;
+                uint64_t ns;
+                uint64_t thread;
+                uint32_t payloadLen;
+                valid = (remaining >= (LOG_BINARY_EVENT_HEADER - 1));
+                if (!valid)
+                {
+                    break;
+                }
+
+                memcpy(&siteId, data + position, sizeof(siteId));
+                memcpy(&ns, data + position + 4, sizeof(ns));
+                memcpy(&thread, data + position + 12, sizeof(thread));
+                memcpy(&payloadLen, data + position + 20, sizeof(payloadLen));
+                position += LOG_BINARY_EVENT_HEADER - 1;
+
+                valid = (siteId < sitesCapacity) && (sites[siteId].fmt != NULL) && (payloadLen <= ((size_t)size - position));
+                if (!valid)
+                {
+                    break;
+                }
+
+                if (eventsCount == eventsCapacity)
+                {
+                    size_t capacity = eventsCapacity ? eventsCapacity * 2 : 1024;
+                    LogBinaryEvent* grown = (capacity <= SIZE_MAX / sizeof(LogBinaryEvent)) ?
+                                            (LogBinaryEvent*)realloc(events, capacity * sizeof(LogBinaryEvent)) : NULL;
+                    valid = (grown != NULL);
+                    if (!valid)
+                    {
+                        break;
+                    }
+                    events = grown;
+                    eventsCapacity = capacity;
+                }
+
+                // rendered later: sites and names seen so far are enough for it
+                events[eventsCount++] = (LogBinaryEvent)
+                {
+                    .ns = ns,
+                    .thread = thread,
+                    .payload = position,
+                    .payloadLen = payloadLen,
+                    .siteId = siteId,
+                    .threadsCount = threadsCount
+                };
+                position += payloadLen;
+            }
+            else
+            {
+                valid = false;
+            }
+        }
+
+        // every thread flushes its own buffer: records are merged by time,
+        // those read before a corruption are still rendered
+        if (eventsCount > 0)
+        {
+            qsort(events, eventsCount, sizeof(LogBinaryEvent), log_binary_event_compare);
+        }
+
+        // stored arguments are limited: so is the rendered message
+        LogThreadContext* context = log_thread_context();
+        bool rendered = (context != NULL) && log_buffer_reserve(&context->message, &context->messageSize, LOG_BINARY_EVENT_MAX);
+        for (size_t idx = 0; rendered && (idx < eventsCount); ++idx)
+        {
+            const LogBinaryEvent* event = &events[idx];
+            const LogBinarySite* site = &sites[event->siteId];
+            size_t messageLen = log_binary_render(site, data + event->payload, event->payloadLen, context->message, context->messageSize);
+
+            // thread ids are reused: the latest name wins
+            char threadString[LOG_DECIMAL_MAX_LEN];
+            const char* threadLabel = threadString;
+            size_t threadLabelLen = log_record_decimal(threadString, event->thread);
+            for (size_t thread = event->threadsCount; thread > 0; --thread)
+            {
+                if (threads[thread - 1].id == event->thread)
+                {
+                    threadLabel = threads[thread - 1].label;
+                    threadLabelLen = threads[thread - 1].labelLen;
+                    break;
+                }
+            }
+
+            LogRecord logRecord = 
+            {
+                .severity = (LogSeverityEnum)site->severity,
+                .file = site->file,
+                .line = site->line,
+                .message = context->message,
+                .messageLen = messageLen,
+                .timestamp = { .tv_sec = (time_t)(event->ns / 1000000000ull), .tv_nsec = (long)(event->ns % 1000000000ull) },
+                .thread = event->thread,
+                .threadLabel = threadLabel,
+                .threadLabelLen = threadLabelLen
+            };
+
+            size_t formatted = log_record_render(context, program, &logRecord);
+            if (formatted)
+            {
+                log_record_write(LOG_OUTPUT_ID_STDOUT_E, logRecord.severity, context->record, formatted);
+            }
+        }
+
+        if (!valid)
+        {
+            printf("ERROR = binary log is corrupted\n");
+            break;
+        }
+
+        result = rendered ? 0 : -1;
+    } while (0);
+
+    if (input != NULL)
+    {
+        fclose(input);
+    }
+    if (program != NULL)
+    {
+        aligned_free(program);
+    }
+    free(events);
+    free(threads);
+    free(sites);
+    free(data);
+#else
+    (void)path;
+#endif
+
+    return result;
+}
+
+void logging_destroy()
+{
+    // dumper logs through the outputs closed below
+    logging_stop_stats_dump();
+
+    // queued records are still rendered with the current formats
+    logging_stop_async();
+    logging_stop_stdout_batch();
+    logging_close_file();
+    logging_close_mmap();
+    logging_close_binary();
+    logging_stop_recorder();
+
+    FmtProgram* replaced[LOG_OUTPUT_ID_MAX_E];
+    for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        replaced[output] = atomic_exchange(&outFormats[output], NULL);
+    }
+
+    log_update_enabled_mask();
+    log_epoch_synchronize();
+
+    for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        if (replaced[output] != NULL)
+        {
+            // ops and pool belong to the same allocation
+            aligned_free(replaced[output]);
+        }
+    }
+}
+
+bool logging_start_async(size_t capacity, LogOverflowPolicyEnum policy)
+{
+    bool result = false;
+
+#ifdef __linux__
+    result = log_async_start(capacity, policy, false);
+#else
+    (void)capacity;
+    (void)policy;
+#endif
+
+    return result;
+}
+
+bool logging_start_async_per_thread(size_t capacity, LogOverflowPolicyEnum policy)
+{
+    bool result = false;
+
+#ifdef __linux__
+    // writer can't take the oldest record from under the producer
+    result = (policy != LOG_OVERFLOW_DROP_OLDEST_E) && log_async_start(capacity, policy, true);
+#else
+    (void)capacity;
+    (void)policy;
+#endif
+
+    return result;
+}
+
+void logging_stop_async()
+{
+#ifdef __linux__
+    LogAsyncRing* ring = atomic_exchange(&asyncRing, NULL);
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    // in-flight records must be pushed before the final drain,
+    // writer is still running: blocked producers make progress
+    log_epoch_synchronize();
+
+    pthread_mutex_lock(&ring->lock);
+    atomic_store(&ring->running, false);
+    pthread_cond_signal(&ring->wakeup);
+    pthread_mutex_unlock(&ring->lock);
+
+    // writer drains the queue before exit
+    pthread_join(ring->writer, NULL);
+
+    for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        LogAsyncQueue* queue = atomic_exchange(&context->asyncQueue, NULL);
+        if (queue != NULL)
+        {
+            aligned_free(queue);
+        }
+    }
+
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->wakeup);
+    log_async_free(ring);
+#endif
+}
+
+bool logging_start_recorder(const char* path, const char* format, size_t slots)
+{
+    bool result = false;
+
+#ifdef __linux__
+    LogRecorder* recorder = NULL;
+
+    do
+    {
+        slots = slots ? slots : LOG_RECORDER_SLOTS_DEFAULT;
+        if ((path == NULL) || (strlen(path) >= LOG_FILE_PATH_MAX) || (slots & (slots - 1)) ||
+            (format == NULL) || (strlen(format) == 0) || (strlen(format) > UINT32_MAX))
+        {
+            break;
+        }
+
+        if (atomic_load(&flightRecorder) != NULL)
+        {
+            // already started
+            break;
+        }
+
+        recorder = (LogRecorder*)calloc(1, sizeof(LogRecorder));
+        if (recorder == NULL)
+        {
+            break;
+        }
+
+        // compiled here only to validate it and find its clock
+        FmtProgram* program = fmt_compile(format, true);
+        if (program == NULL)
+        {
+            break;
+        }
+        recorder->clock = program->clock;
+        aligned_free(program);
+
+        recorder->format = strdup(format);
+        if (recorder->format == NULL)
+        {
+            break;
+        }
+        recorder->formatLen = (uint32_t)strlen(format);
+
+        recorder->slots = slots;
+        strcpy(recorder->path, path);
+        atomic_flag_clear(&recorder->dumping);
+
+        struct sigaction action = { .sa_handler = log_recorder_signal };
+        sigemptyset(&action.sa_mask);
+        for (size_t idx = 0; idx < (sizeof(recorderSignals) / sizeof(recorderSignals[0])); ++idx)
+        {
+            (void)sigaction(recorderSignals[idx], &action, &recorder->previous[idx]);
+        }
+
+        atomic_store(&flightRecorder, recorder);
+        log_update_enabled_mask();
+        result = true;
+    } while (0);
+
+    if (!result && (recorder != NULL))
+    {
+        free(recorder->format);
+        free(recorder);
+    }
+#else
+    (void)path;
+    (void)format;
+    (void)slots;
+#endif
+
+    return result;
+}
+
+void logging_stop_recorder()
+{
+#ifdef __linux__
+    LogRecorder* recorder = atomic_exchange(&flightRecorder, NULL);
+    if (recorder == NULL)
+    {
+        return;
+    }
+
+    for (size_t idx = 0; idx < (sizeof(recorderSignals) / sizeof(recorderSignals[0])); ++idx)
+    {
+        (void)sigaction(recorderSignals[idx], &recorder->previous[idx], NULL);
+    }
+
+    // after that rings have no writers
+    log_update_enabled_mask();
+    log_epoch_synchronize();
+
+    for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        free(atomic_exchange(&context->recorder, NULL));
+        atomic_store(&context->recorderNext, 0);
+    }
+
+    free(recorder->format);
+    free(recorder);
+#endif
+}
+
+bool logging_dump_recorder()
+{
+    bool result = false;
+
+#ifdef __linux__
+    LogThreadContext* context = log_thread_context();
+    if (context == NULL)
+    {
+        return false;
+    }
+
+    // recorder can't be stopped while it's dumped
+    bool entered = log_epoch_enter(context);
+    LogRecorder* recorder = atomic_load_explicit(&flightRecorder, memory_order_acquire);
+    if (recorder != NULL)
+    {
+        result = log_recorder_dump(recorder);
+    }
+    log_epoch_exit(context, entered);
+#endif
+
+    return result;
+}
+
+bool logging_get_stats(LogStats* stats)
+{
+    if (stats == NULL)
+    {
+        return false;
+    }
+
+    // counters only grow: the sum is consistent enough without locks
+    memset(stats, 0, sizeof(LogStats));
+    for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        LogThreadStats* counters = &context->stats;
+        for (int severity = 0; severity < LOG_SEVERITY_MAX_E; ++severity)
+        {
+            stats->records[severity] += atomic_load_explicit(&counters->records[severity], memory_order_relaxed);
+        }
+
+        stats->suppressed += atomic_load_explicit(&counters->suppressed, memory_order_relaxed);
+        stats->dropped += atomic_load_explicit(&counters->dropped, memory_order_relaxed);
+        stats->truncated += atomic_load_explicit(&counters->truncated, memory_order_relaxed);
+
+        for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+        {
+            stats->bytes[output] += atomic_load_explicit(&counters->bytes[output], memory_order_relaxed);
+            for (int bucket = 0; bucket < LOG_STATS_LATENCY_BUCKETS; ++bucket)
+            {
+                stats->latency[output][bucket] += atomic_load_explicit(&counters->latency[output][bucket], memory_order_relaxed);
+            }
+        }
+
+        uint64_t depth = atomic_load_explicit(&counters->asyncDepthMax, memory_order_relaxed);
+        if (depth > stats->asyncDepthMax)
+        {
+            stats->asyncDepthMax = depth;
+        }
+    }
+
+    return true;
+}
+
+bool logging_start_stats_dump(uint32_t intervalMs, LogSeverityEnum severity)
+{
+    bool result = false;
+
+#ifdef __linux__
+    LogStatsDumper* dumper = NULL;
+
+    do
+    {
+        if ((intervalMs == 0) || (severity >= LOG_SEVERITY_MAX_E))
+        {
+            break;
+        }
+
+        if (atomic_load(&statsDumper) != NULL)
+        {
+            // already started
+            break;
+        }
+
+        dumper = (LogStatsDumper*)calloc(1, sizeof(LogStatsDumper));
+        if (dumper == NULL)
+        {
+            break;
+        }
+
+        dumper->intervalMs = intervalMs;
+        dumper->severity = severity;
+        dumper->running = true;
+        pthread_mutex_init(&dumper->lock, NULL);
+        pthread_cond_init(&dumper->wakeup, NULL);
+
+        if (pthread_create(&dumper->thread, NULL, log_stats_dumper, dumper) != 0)
+        {
+            pthread_mutex_destroy(&dumper->lock);
+            pthread_cond_destroy(&dumper->wakeup);
+            break;
+        }
+
+        atomic_store(&statsDumper, dumper);
+        result = true;
+    } while (0);
+
+    if (!result)
+    {
+        free(dumper);
+    }
+#else
+    (void)intervalMs;
+    (void)severity;
+#endif
+
+    return result;
+}
+
+void logging_stop_stats_dump()
+{
+#ifdef __linux__
+    LogStatsDumper* dumper = atomic_exchange(&statsDumper, NULL);
+    if (dumper == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&dumper->lock);
+    dumper->running = false;
+    pthread_cond_signal(&dumper->wakeup);
+    pthread_mutex_unlock(&dumper->lock);
+    pthread_join(dumper->thread, NULL);
+
+    pthread_mutex_destroy(&dumper->lock);
+    pthread_cond_destroy(&dumper->wakeup);
+    free(dumper);
+#endif
+}
+
+bool logging_parse_benchmark(int argc, char** argv, LogBenchConfig* config)
+{
+    // <sink>[+async|+perthread][+batch][+uring] [threads] [records] [message size] [format]
+    bool result = false;
+
+#ifdef __linux__
+    do
+    {
+        if ((argc < 1) || (config == NULL))
+        {
+            break;
+        }
+
+        *config = (LogBenchConfig)
+        {
+            .sink = LOG_BENCH_SINK_MAX_E,
+            .threads = LOG_BENCH_THREADS_DEFAULT,
+            .records = LOG_BENCH_RECORDS_DEFAULT,
+            .messageSize = LOG_BENCH_MESSAGE_DEFAULT
+        };
+
+        size_t nameLen = strcspn(argv[0], "+");
+        for (int sink = 0; sink < LOG_BENCH_SINK_MAX_E; ++sink)
+        {
+            if ((strlen(benchSinks[sink]) == nameLen) && (strncmp(argv[0], benchSinks[sink], nameLen) == 0))
+            {
+                config->sink = (LogBenchSinkEnum)sink;
+            }
+        }
+
+        config->perThread = (strstr(argv[0], "+perthread") != NULL);
+        config->async = config->perThread || (strstr(argv[0], "+async") != NULL);
+        config->batch = (strstr(argv[0], "+batch") != NULL);
+        config->uring = (strstr(argv[0], "+uring") != NULL);
+
+        size_t threads = config->threads;
+        bool numbers = ((argc <= 1) || log_bench_number(argv[1], UINT32_MAX, &threads)) &&
+                       ((argc <= 2) || log_bench_number(argv[2], SIZE_MAX, &config->records)) &&
+                       ((argc <= 3) || log_bench_number(argv[3], INT32_MAX - 1, &config->messageSize));
+        config->threads = (unsigned int)threads;
+        config->format = (argc > 4) ? argv[4] : NULL;
+
+        // products of the counts are checked by logging_benchmark()
+        result = numbers && (config->sink != LOG_BENCH_SINK_MAX_E) && config->threads && config->records;
+    } while (0);
+#else
+    (void)argc;
+    (void)argv;
+    (void)config;
+#endif
+
+    return result;
+}
+
+int logging_benchmark(const LogBenchConfig* config)
+{
+    int result = -1;
+
+#ifdef __linux__
+    LogBenchThread* threads = NULL;
+    pthread_t* workers = NULL;
+    uint32_t* latencies = NULL;
+    int savedStdout = -1;
+    int pipeFds[2] = { -1, -1 };
+    pthread_t drainer;
+    bool draining = false;
+    LogBenchStart start = { .waiting = 0 };
+    bool gate = false;
+    unsigned int started = 0;
+
+    do
+    {
+        if ((config == NULL) || (config->sink >= LOG_BENCH_SINK_MAX_E) || !config->threads || !config->records)
+        {
+            break;
+        }
+
+        // latency of every record is kept: the array must be addressable, the message renderable
+        if ((config->records > (SIZE_MAX / sizeof(uint32_t) / config->threads)) || (config->messageSize >= INT32_MAX))
+        {
+            break;
+        }
+
+        const char* path = config->path ? config->path : LOG_BENCH_PATH_DEFAULT;
+        const char* format = config->format ? config->format : "%timestamp{%T.%f} %filename %line %thread [ %severity ] %message%endl";
+        size_t total = config->threads * config->records;
+
+        threads = (LogBenchThread*)calloc(config->threads, sizeof(LogBenchThread));
+        workers = (pthread_t*)calloc(config->threads, sizeof(pthread_t));
+        latencies = (uint32_t*)malloc(total * sizeof(uint32_t));
+        if ((threads == NULL) || (workers == NULL) || (latencies == NULL))
+        {
+            break;
+        }
+
+        // stdout sinks: descriptor 1 is replaced for the run, results go to the original
+        LogOutputIdEnum output = LOG_OUTPUT_ID_STDOUT_E;
+        bool ready = true;
+        if ((config->sink == LOG_BENCH_SINK_NULL_E) || (config->sink == LOG_BENCH_SINK_PIPE_E))
+        {
+            fflush(stdout);
+            savedStdout = dup(STDOUT_FILENO);
+            int target = -1;
+            if (config->sink == LOG_BENCH_SINK_NULL_E)
+            {
+                target = open("/dev/null", O_WRONLY | O_CLOEXEC);
+            }
+            else if (pipe(pipeFds) == 0)
+            {
+                target = pipeFds[1];
+                draining = (pthread_create(&drainer, NULL, log_bench_drain, &pipeFds[0]) == 0);
+            }
+
+            ready = (savedStdout != -1) && (target != -1) && (dup2(target, STDOUT_FILENO) != -1) && 
+                    ((config->sink == LOG_BENCH_SINK_NULL_E) || draining);
+            if (target != -1)
+            {
+                // stdout keeps the pipe open for the drainer
+                close(target);
+                pipeFds[1] = -1;
+            }
+
+            LogStdoutConfig batch = { 0 };
+            ready = ready && (!config->batch || logging_start_stdout_batch(&batch));
+        }
+        else if (config->sink == LOG_BENCH_SINK_FILE_E)
+        {
+            output = LOG_OUTPUT_ID_FILE_E;
+            unlink(path);
+            LogFileConfig file = { .path = path, .flushSeverity = LOG_SEVERITY_ERROR_E, .uring = config->uring };
+            ready = logging_open_file(&file);
+        }
+        else
+        {
+            output = LOG_OUTPUT_ID_MMAP_E;
+            ready = logging_open_mmap(path, 0);
+        }
+
+        ready = ready && logging_set_format(output, format) && logging_set_severity(output, LOG_SEVERITY_INFO_E);
+        ready = ready && (!config->async || (config->perThread ? logging_start_async_per_thread(LOG_BENCH_ASYNC_CAPACITY, LOG_OVERFLOW_BLOCK_E)
+                                                               : logging_start_async(LOG_BENCH_ASYNC_CAPACITY, LOG_OVERFLOW_BLOCK_E)));
+        if (!ready)
+        {
+            break;
+        }
+
+        // throughput is what the sink took: records differ in timestamp, thread and number
+        LogStats before;
+        (void)logging_get_stats(&before);
+
+        gate = (pthread_mutex_init(&start.lock, NULL) == 0);
+        if (gate && (pthread_cond_init(&start.wakeup, NULL) != 0))
+        {
+            pthread_mutex_destroy(&start.lock);
+            gate = false;
+        }
+        if (!gate)
+        {
+            break;
+        }
+
+        for (; started < config->threads; ++started)
+        {
+            threads[started] = (LogBenchThread)
+            {
+                .config = config,
+                .start = &start,
+                .latencies = latencies + started * config->records
+            };
+
+            if (pthread_create(&workers[started], NULL, log_bench_worker, &threads[started]) != 0)
+            {
+                break;
+            }
+        }
+
+        if (started != config->threads)
+        {
+            // started workers are told to quit below
+            break;
+        }
+
+        struct timespec begin;
+        struct timespec end;
+        pthread_mutex_lock(&start.lock);
+        while (start.waiting != config->threads)
+        {
+            pthread_cond_wait(&start.wakeup, &start.lock);
+        }
+        start.released = true;
+        pthread_cond_broadcast(&start.wakeup);
+        pthread_mutex_unlock(&start.lock);
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+
+        for (; started > 0; --started)
+        {
+            pthread_join(workers[started - 1], NULL);
+        }
+
+        // queued and buffered records are counted when they are written
+        logging_stop_async();
+        logging_stop_stdout_batch();
+        logging_close_file();
+        logging_close_mmap();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double seconds = (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+        qsort(latencies, total, sizeof(uint32_t), log_bench_compare);
+
+        LogStats after;
+        (void)logging_get_stats(&after);
+        uint64_t bytes = after.bytes[output] - before.bytes[output];
+
+        if (savedStdout != -1)
+        {
+            // drainer sees the end of the pipe
+            dup2(savedStdout, STDOUT_FILENO);
+        }
+
+        printf("sink      : %s%s%s%s\n", benchSinks[config->sink], config->perThread ? "+perthread" : (config->async ? "+async" : ""), 
+               config->batch ? "+batch" : "", config->uring ? "+uring" : "");
+        printf("format    : %s\n", format);
+        printf("threads   : %u\n", config->threads);
+        printf("records   : %zu, %llu bytes\n", total, (unsigned long long)bytes);
+        printf("time      : %.3f s\n", seconds);
+        printf("records/s : %.0f\n", (double)total / seconds);
+        printf("bytes/s   : %.0f\n", (double)bytes / seconds);
+        printf("latency   : p50 %u ns, p99 %u ns, p999 %u ns, max %u ns\n", 
+               log_bench_percentile(latencies, total, 0.50), log_bench_percentile(latencies, total, 0.99), 
+               log_bench_percentile(latencies, total, 0.999), latencies[total - 1]);
+        result = 0;
+    } while (0);
+
+    // every exit above ends here: workers are joined and sinks closed before stdout is restored
+    if (started != 0)
+    {
+        pthread_mutex_lock(&start.lock);
+        start.released = true;
+        start.aborted = true;
+        pthread_cond_broadcast(&start.wakeup);
+        pthread_mutex_unlock(&start.lock);
+        for (; started > 0; --started)
+        {
+            pthread_join(workers[started - 1], NULL);
+        }
+    }
+    if (gate)
+    {
+        pthread_cond_destroy(&start.wakeup);
+        pthread_mutex_destroy(&start.lock);
+    }
+
+    // all of these do nothing when the sink is not open
+    logging_stop_async();
+    logging_stop_stdout_batch();
+    logging_close_file();
+    logging_close_mmap();
+
+    if (savedStdout != -1)
+    {
+        fflush(stdout);
+        dup2(savedStdout, STDOUT_FILENO);
+        close(savedStdout);
+    }
+
+    if (draining)
+    {
+        pthread_join(drainer, NULL);
+    }
+    if (pipeFds[0] != -1)
+    {
+        close(pipeFds[0]);
+    }
+
+    free(latencies);
+    free(workers);
+    free(threads);
+#else
+    (void)config;
+#endif
+
+    return result;
+}
+
+void write_log(const LogSite* site, const char* format, ...)
+{
+    LogSeverityEnum severity = site->severity;
+
+    // format is the site's one, passed again only to name the arguments
+    const char* fmt = site->fmt;
+
+    // macros check it as well, but write_log() might be called directly
+    if (!LOG_ENABLED(severity))
+    {
+        return;
+    }
+
+    LogThreadContext* context = log_thread_context();
+    if (context == NULL)
+    {
+        // out of memory: record is dropped
+        return;
+    }
+
+    // formats and sinks loaded below can't be freed until exit
+    bool entered = log_epoch_enter(context);
+
+#ifdef __linux__
+    // flight recorder takes every record, before filters and limits
+    LogRecorder* recorder = atomic_load_explicit(&flightRecorder, memory_order_acquire);
+    if (recorder != NULL)
+    {
+        va_list args;
+        va_start(args, format);
+        log_recorder_write(recorder, context, site, args);
+        va_end(args);
+    }
+#endif
+
+#ifdef __linux__
+    // binary sites skip the outputs while the sink is open, other sites aren't affected
+    LogBinarySink* binary = site->binary ? atomic_load_explicit(&binarySink, memory_order_acquire) : NULL;
+    binary = ((binary != NULL) && (severity <= binary->severity)) ? binary : NULL;
+#else
+    const void* binary = NULL;      // no binary mode
+#endif
+
+    // severities taken only by the flight recorder end here
+    if ((binary == NULL) && !(atomic_load_explicit(&logOutputMask, memory_order_relaxed) & (1u << severity)))
+    {
+        log_epoch_exit(context, entered);
+        return;
+    }
+
+    // limits are checked before any work is done for the record
+    uint32_t suppressed = 0;
+    if (!log_site_pass(site, &suppressed))
+    {
+        LOG_STATS_ADD(context->stats.suppressed, 1);
+        log_epoch_exit(context, entered);
+        return;
+    }
+    LOG_STATS_ADD(context->stats.records[severity], 1);
+
+    if (suppressed)
+    {
+        // limit window is over: report what was dropped before the record
+        write_log(&suppressedSites[severity], suppressedSites[severity].fmt, suppressed, log_site_file(site), site->line);
+    }
+
+#ifdef __linux__
+    // binary mode: raw arguments are stored, text is rendered offline
+    if (binary != NULL)
+    {
+        va_list args;
+        va_start(args, format);
+        log_binary_write(binary, context, site, args);
+        va_end(args);
+        log_epoch_exit(context, entered);
+        return;
+    }
+#endif
+
+    if (!log_buffer_reserve(&context->message, &context->messageSize, LOG_RECORD_INITIAL_SIZE))
+    {
+        log_epoch_exit(context, entered);
+        return;
+    }
+
+    // message is the same for every output: vsnprintf() runs once,
+    // twice when it doesn't fit the thread's buffer
+    va_list args;
+    va_list retryArgs;
+	va_start(args, format);
+    va_copy(retryArgs, args);
+    int messageLen = vsnprintf(context->message, context->messageSize, fmt, args);
+    if ((messageLen > 0) && ((size_t)messageLen >= context->messageSize) &&
+        log_buffer_reserve(&context->message, &context->messageSize, (size_t)messageLen + 1))
+    {
+        messageLen = vsnprintf(context->message, context->messageSize, fmt, retryArgs);
+    }
+    va_end(retryArgs);
+    va_end(args);
+
+    if ((messageLen > 0) && ((size_t)messageLen >= context->messageSize))
+    {
+        // buffer couldn't grow: message is cut
+        LOG_STATS_ADD(context->stats.truncated, 1);
+    }
+
+    LogRecord logRecord = 
+    {
+        .severity = severity,
+        .file = log_site_file(site),
+        .line = site->line,
+        .message = context->message,
+        .messageLen = (messageLen < 0) ? 0 : (((size_t)messageLen < context->messageSize) ? (size_t)messageLen : context->messageSize - 1),
+        .thread = context->threadId,
+        .threadLabel = context->threadLabel,
+        .threadLabelLen = context->threadLabelLen
+    };
+
+    // every format reads its own clock, each one is read once before the first render
+    const FmtProgram* programs[LOG_OUTPUT_ID_MAX_E] = { NULL };
+    unsigned int clocks = 0;
+    for (LogOutputIdEnum output = LOG_OUTPUT_ID_STDOUT_E; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        if (severity > atomic_load_explicit(&outSeverity[output], memory_order_relaxed))
+        {
+            continue;
+        }
+
+        // caller is inside an epoch: program stays valid until it leaves
+        programs[output] = atomic_load_explicit(&outFormats[output], memory_order_acquire);
+        if ((programs[output] != NULL) && (programs[output]->clock != FMT_CLOCK_MAX_E))
+        {
+            clocks |= 1u << programs[output]->clock;
+        }
+    }
+
+#ifdef __linux__
+    // per-thread queues: writer doesn't pass records newer than the one in flight,
+    // records are ordered by the most precise clock in use, the writer reads the same one
+    LogAsyncRing* ring = atomic_load_explicit(&asyncRing, memory_order_acquire);
+    bool merged = (ring != NULL) && ring->perThread;
+    if (merged)
+    {
+        atomic_store(&context->asyncPending, LOG_ASYNC_PENDING_CLOCK);
+        clocks |= atomic_load_explicit(&logClocks, memory_order_relaxed);
+    }
+#endif
+
+    struct timespec stamps[FMT_CLOCK_MAX_E] = { { 0 } };
+    uint64_t timestamp = log_record_clocks(clocks, stamps);
+
+#ifdef __linux__
+    if (merged)
+    {
+        atomic_store(&context->asyncPending, timestamp);
+    }
+#else
+    (void)timestamp;
+#endif
+
+    for (LogOutputIdEnum output = LOG_OUTPUT_ID_STDOUT_E; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        const FmtProgram* program = programs[output];
+        if (program == NULL)
+        {
+            continue;
+        }
+
+        if (program->clock != FMT_CLOCK_MAX_E)
+        {
+            logRecord.timestamp = stamps[program->clock];
+        }
+
+        size_t formatted = log_record_render(context, program, &logRecord);
+        if (formatted)
+        {
+        #ifdef __linux__
+            if (merged)
+            {
+                if (!log_async_queue_push(ring, context, output, severity, timestamp, context->record, formatted))
+                {
+                    LOG_STATS_ADD(context->stats.dropped, 1);
+                }
+                continue;
+            }
+
+            if (ring != NULL)
+            {
+                // discarded oldest records are counted by the push itself
+                if (!log_async_push(ring, context, output, severity, context->record, formatted))
+                {
+                    LOG_STATS_ADD(context->stats.dropped, 1);
+                }
+                continue;
+            }
+        #endif
+
+            log_stats_write(context, output, severity, context->record, formatted);
+        }
+    }
+
+#ifdef __linux__
+    if (merged)
+    {
+        atomic_store_explicit(&context->asyncPending, LOG_ASYNC_PENDING_IDLE, memory_order_release);
+    }
+#endif
+
+    log_epoch_exit(context, entered);
+}
+
+/************************************************************************
+ *					S T A T I C   F U N C T I O N S     				*
+ ************************************************************************/
+
+void log_update_enabled_mask()
+{
+    unsigned int mask = 0;
+    unsigned int allSeverities = (1u << LOG_SEVERITY_MAX_E) - 1;
+
+    for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        if (atomic_load(&outFormats[output]) == NULL)
+        {
+            continue;
+        }
+
+    #ifdef __linux__
+        if ((output == LOG_OUTPUT_ID_FILE_E) && (atomic_load(&fileSink) == NULL))
+        {
+            // nowhere to write
+            continue;
+        }
+
+        if ((output == LOG_OUTPUT_ID_MMAP_E) && (atomic_load(&mmapSink) == NULL))
+        {
+            continue;
+        }
+    #endif
+
+        // severities are ordered from the most important one
+        LogSeverityEnum least = atomic_load(&outSeverity[output]);
+        mask |= (1u << (least + 1)) - 1;
+    }
+
+    atomic_store(&logOutputMask, mask);
+
+#ifdef __linux__
+    // binary sites are also enabled by the sink's own severity
+    LogBinarySink* binary = atomic_load(&binarySink);
+    if (binary != NULL)
+    {
+        mask |= (1u << (binary->severity + 1)) - 1;
+    }
+
+    if (atomic_load(&flightRecorder) != NULL)
+    {
+        // recorder is always on, even for records filtered from outputs
+        mask = allSeverities;
+    }
+#endif
+
+    atomic_store(&logEnabledMask, mask);
+
+    // clocks follow the same configuration changes
+    log_update_clock();
+}
+
+void log_update_clock()
+{
+    unsigned int clocks = 0;
+
+    for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        // the program can't be freed here: it's replaced by the caller only
+        FmtProgram* program = atomic_load(&outFormats[output]);
+        if ((program != NULL) && (program->clock != FMT_CLOCK_MAX_E))
+        {
+            clocks |= 1u << program->clock;
+        }
+    }
+
+#ifdef __linux__
+    LogBinarySink* binary = atomic_load(&binarySink);
+    if ((binary != NULL) && (binary->clock != FMT_CLOCK_MAX_E))
+    {
+        clocks |= 1u << binary->clock;
+    }
+
+    LogRecorder* recorder = atomic_load(&flightRecorder);
+    if ((recorder != NULL) && (recorder->clock != FMT_CLOCK_MAX_E))
+    {
+        clocks |= 1u << recorder->clock;
+    }
+#endif
+
+    // no timestamp units anywhere: async merge still wants a clock
+    if (!clocks)
+    {
+        clocks = 1u << FMT_CLOCK_REALTIME_E;
+    }
+
+#ifdef LOG_TSC_SUPPORTED
+    // until it's calibrated the tsc clock reads the coarse one
+    if (clocks & (1u << FMT_CLOCK_TSC_E))
+    {
+        pthread_once(&tscClockOnce, log_tsc_calibrate);
+    }
+#endif
+
+    atomic_store(&logClocks, clocks);
+}
+
+const char* log_site_file(const LogSite* site)
+{
+#ifdef __FILE_NAME__
+    return site->file;
+#else
+    const char* file = atomic_load_explicit(&site->state->file, memory_order_relaxed);
+    if (file == NULL)
+    {
+        // the same result in every thread: race is harmless
+        file = site->file;
+        for (const char* symbol = site->file; *symbol; ++symbol)
+        {
+            if ((*symbol == '/') || (*symbol == '\\'))
+            {
+                file = symbol + 1;
+            }
+        }
+        atomic_store_explicit(&site->state->file, file, memory_order_relaxed);
+    }
+
+    return file;
+#endif
+}
+
+bool log_site_pass(const LogSite* site, uint32_t* suppressed)
+{
+    LogSeverityEnum severity = site->severity;
+    if (!(atomic_load_explicit(&logLimitMask, memory_order_relaxed) & (1u << severity)) || site->unlimited)
+    {
+        // no limits: a single load
+        return true;
+    }
+
+    LogSiteState* state = site->state;
+    bool pass = true;
+
+    uint32_t sampleEvery = atomic_load_explicit(&limitSample[severity], memory_order_relaxed);
+    if (sampleEvery > 1)
+    {
+        pass = ((atomic_fetch_add_explicit(&state->sampled, 1, memory_order_relaxed) % sampleEvery) == 0);
+    }
+
+    uint64_t interval = atomic_load_explicit(&limitInterval[severity], memory_order_relaxed);
+    if (pass && interval)
+    {
+        // token bucket in the GCRA form: a single word per site, updated by CAS;
+        // record passes if it doesn't come earlier than the burst allows
+        uint64_t tolerance = atomic_load_explicit(&limitTolerance[severity], memory_order_relaxed);
+        uint64_t now = log_limit_clock();
+        uint64_t arrival = atomic_load_explicit(&state->arrival, memory_order_relaxed);
+        uint64_t next;
+
+        do
+        {
+            uint64_t base = (arrival > now) ? arrival : now;
+            if ((base - now) > tolerance)
+            {
+                pass = false;
+                break;
+            }
+            next = base + interval;
+        } while (!atomic_compare_exchange_weak_explicit(&state->arrival, &arrival, next, memory_order_relaxed, memory_order_relaxed));
+    }
+
+    if (!pass)
+    {
+        atomic_fetch_add_explicit(&state->suppressed, 1, memory_order_relaxed);
+        return false;
+    }
+
+    if (atomic_load_explicit(&state->suppressed, memory_order_relaxed))
+    {
+        *suppressed = atomic_exchange_explicit(&state->suppressed, 0, memory_order_relaxed);
+    }
+
+    return true;
+}
+
+const uint8_t* log_site_signature(const LogSite* site, uint8_t* args, uint8_t* argCount)
+{
+    LogSiteState* state = site->state;
+    if (atomic_load_explicit(&state->argState, memory_order_acquire) == LOG_SITE_ARGS_READY)
+    {
+        *argCount = state->argCount;
+        return state->args;
+    }
+
+#ifdef __linux__
+    if (!log_binary_signature(site->fmt, args, argCount))
+#endif
+    {
+        *argCount = LOG_BINARY_PREFORMATTED;
+    }
+
+    // the first thread caches it, the others use their own copy meanwhile
+    unsigned char expected = LOG_SITE_ARGS_UNKNOWN;
+    if (atomic_compare_exchange_strong(&state->argState, &expected, LOG_SITE_ARGS_BUSY))
+    {
+        memcpy(state->args, args, sizeof(state->args));
+        state->argCount = *argCount;
+        atomic_store_explicit(&state->argState, LOG_SITE_ARGS_READY, memory_order_release);
+    }
+
+    return args;
+}
+
+uint64_t log_limit_clock()
+{
+#ifdef __linux__
+    // tick resolution is enough for rates, and it's the cheapest clock
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#elif defined(_WIN32)
+    return (uint64_t)GetTickCount64() * 1000000ull;
+#endif
+}
+
+void log_record_clock(unsigned int clock, struct timespec* now)
+{
+#ifdef __linux__
+    switch (clock)
+    {
+        case FMT_CLOCK_TSC_E:
+        {
+        #ifdef LOG_TSC_SUPPORTED
+            if (atomic_load_explicit(&tscClock.usable, memory_order_acquire))
+            {
+                log_tsc_clock(now);
+                break;
+            }
+        #endif
+            clock_gettime(CLOCK_REALTIME_COARSE, now);
+        }
+        break;
+
+        case FMT_CLOCK_COARSE_E:
+        {
+            clock_gettime(CLOCK_REALTIME_COARSE, now);
+        }
+        break;
+
+        default:
+        {
+            clock_gettime(CLOCK_REALTIME, now);
+        }
+        break;
+    }
+#elif defined (_WIN32)
+    (void)clock;
+    struct _timeb timebuffer;
+    _ftime(&timebuffer);
+    now->tv_sec = (time_t)timebuffer.time;
+    now->tv_nsec = (long)timebuffer.millitm * 1000000;
+#endif
+}
+
+uint64_t log_record_clocks(unsigned int clocks, struct timespec* stamps)
+{
+    // clocks are ordered from the most precise one, it orders records
+    uint64_t precise = UINT64_MAX;
+    for (unsigned int clock = 0; clock < FMT_CLOCK_MAX_E; ++clock)
+    {
+        if (clocks & (1u << clock))
+        {
+            log_record_clock(clock, &stamps[clock]);
+            if (precise == UINT64_MAX)
+            {
+                precise = (uint64_t)stamps[clock].tv_sec * 1000000000ull + (uint64_t)stamps[clock].tv_nsec;
+            }
+        }
+    }
+
+    return precise;
+}
+
+#ifdef LOG_TSC_SUPPORTED
+
+void log_tsc_calibrate()
+{
+    // TSC must tick at constant rate in every power state
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8)))
+    {
+        return;
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_REALTIME, &begin);
+    uint64_t tscBegin = __rdtsc();
+
+    struct timespec window = { .tv_sec = 0, .tv_nsec = LOG_TSC_CALIBRATE_MS * 1000000L };
+    while (nanosleep(&window, &window) == -1 && errno == EINTR)
+    {
+        // interrupted: sleep the rest
+    }
+
+    clock_gettime(CLOCK_REALTIME, &end);
+    uint64_t tscEnd = __rdtsc();
+
+    int64_t elapsed = (int64_t)(end.tv_sec - begin.tv_sec) * 1000000000ll + (end.tv_nsec - begin.tv_nsec);
+    if ((elapsed <= 0) || (tscEnd <= tscBegin))
+    {
+        // realtime clock was stepped: cheaper clocks will do
+        return;
+    }
+
+    uint64_t mult = ((uint64_t)elapsed << LOG_TSC_SHIFT) / (tscEnd - tscBegin);
+    if (mult == 0)
+    {
+        return;
+    }
+
+    atomic_store(&tscClock.mult, mult);
+    atomic_store(&tscClock.tscBase, tscEnd);
+    atomic_store(&tscClock.nsBase, (uint64_t)end.tv_sec * 1000000000ull + (uint64_t)end.tv_nsec);
+    tscClock.resyncTicks = ((uint64_t)LOG_TSC_RESYNC_MS * 1000000ull << LOG_TSC_SHIFT) / mult;
+    atomic_store_explicit(&tscClock.usable, true, memory_order_release);
+}
+
+void log_tsc_resync(uint64_t tsc)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+
+    // ratio over the whole interval is far more precise than calibration one,
+    // it's ignored if the realtime clock was stepped meanwhile
+    uint64_t tscBase = atomic_load_explicit(&tscClock.tscBase, memory_order_relaxed);
+    uint64_t nsBase = atomic_load_explicit(&tscClock.nsBase, memory_order_relaxed);
+    uint64_t mult = atomic_load_explicit(&tscClock.mult, memory_order_relaxed);
+    if ((tsc > tscBase) && (ns > nsBase))
+    {
+        // shifted interval must fit 64 bits: after a long idle the ticks lose their low bits instead
+        uint64_t elapsed = ns - nsBase;
+        unsigned int shift = LOG_TSC_SHIFT;
+        while ((shift > 0) && (elapsed >> (64 - shift)))
+        {
+            --shift;
+        }
+
+        uint64_t ticks = (tsc - tscBase) >> (LOG_TSC_SHIFT - shift);
+        uint64_t measured = ticks ? (elapsed << shift) / ticks : mult;
+        uint64_t deviation = (measured > mult) ? measured - mult : mult - measured;
+        if (deviation < mult / 100)
+        {
+            mult = measured;
+        }
+    }
+
+    // readers retry while the sequence is odd or changed
+    atomic_fetch_add_explicit(&tscClock.sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&tscClock.tscBase, tsc, memory_order_relaxed);
+    atomic_store_explicit(&tscClock.nsBase, ns, memory_order_relaxed);
+    atomic_store_explicit(&tscClock.mult, mult, memory_order_relaxed);
+    atomic_fetch_add_explicit(&tscClock.sequence, 1, memory_order_release);
+}
+
+void log_tsc_clock(struct timespec* now)
+{
+    uint64_t tsc, tscBase, nsBase, mult;
+    unsigned int sequence;
+
+    do
+    {
+        sequence = atomic_load_explicit(&tscClock.sequence, memory_order_acquire);
+        tsc = __rdtsc();
+        tscBase = atomic_load_explicit(&tscClock.tscBase, memory_order_relaxed);
+        nsBase = atomic_load_explicit(&tscClock.nsBase, memory_order_relaxed);
+        mult = atomic_load_explicit(&tscClock.mult, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || (sequence != atomic_load_explicit(&tscClock.sequence, memory_order_relaxed)));
+
+    // counters of cores might differ by a few ticks
+    uint64_t ticks = (tsc > tscBase) ? tsc - tscBase : 0;
+    if ((ticks > tscClock.resyncTicks) && !atomic_flag_test_and_set_explicit(&tscClock.resyncing, memory_order_acquire))
+    {
+        // one thread pays for the realtime clock, the others go on with the old base
+        log_tsc_resync(tsc);
+        atomic_flag_clear_explicit(&tscClock.resyncing, memory_order_release);
+    }
+
+    uint64_t ns = nsBase + log_tsc_scale(ticks, mult);
+    now->tv_sec = (time_t)(ns / 1000000000ull);
+    now->tv_nsec = (long)(ns % 1000000000ull);
+}
+
+uint64_t log_tsc_scale(uint64_t ticks, uint64_t mult)
+{
+    // (ticks * mult) >> LOG_TSC_SHIFT in standard C: products of 32-bit halves,
+    // only the lowest one is shifted, the others are whole multiples of 2^32
+    _Static_assert(LOG_TSC_SHIFT == 32, "halves are split at the fixed point");
+    uint64_t ticksHigh = ticks >> 32;
+    uint64_t ticksLow = ticks & 0xFFFFFFFFull;
+    uint64_t multHigh = mult >> 32;
+    uint64_t multLow = mult & 0xFFFFFFFFull;
+
+    return ((ticksHigh * multHigh) << 32) + ticksHigh * multLow + ticksLow * multHigh + ((ticksLow * multLow) >> 32);
+}
+
+#endif
+
+bool log_buffer_reserve(char** buffer, size_t* size, size_t required)
+{
+    if (*size >= required)
+    {
+        return true;
+    }
+
+    // grows geometrically: a thread reaches its working size in a few records
+    size_t grown = (*size) ? *size : LOG_RECORD_INITIAL_SIZE;
+    while (grown < required)
+    {
+        grown *= 2;
+    }
+
+    // content is not preserved, no need to realloc(),
+    // but the old buffer stays when allocation fails: caller writes what it holds
+    char* allocated = (char*)malloc(grown);
+    if (allocated == NULL)
+    {
+        return false;
+    }
+
+    free(*buffer);
+    *buffer = allocated;
+    *size = grown;
+
+    return true;
+}
+
+size_t log_record_render(LogThreadContext* context, const FmtProgram* program, const LogRecord* record)
+{
+    // decorations rarely take more than the initial size
+    size_t required = record->messageLen + LOG_RECORD_INITIAL_SIZE;
+    size_t formatted = 0;
+
+    if (program == NULL)
+    {
+        return 0;
+    }
+
+    bool reserved = false;
+    while ((reserved = log_buffer_reserve(&context->record, &context->recordSize, required)))
+    {
+        formatted = log_record_format(program, context->record, context->recordSize, record);
+        if (formatted < context->recordSize)
+        {
+            break;
+        }
+
+        // full buffer means the record might be truncated
+        required = context->recordSize * 2;
+    }
+
+    if (!reserved)
+    {
+        // out of memory: the last attempt is still in the buffer, it's written truncated
+        formatted = (formatted < context->recordSize) ? formatted : context->recordSize;
+        if (formatted)
+        {
+            LOG_STATS_ADD(context->stats.truncated, 1);
+        }
+        else
+        {
+            LOG_STATS_ADD(context->stats.dropped, 1);
+        }
+    }
+
+    return formatted;
+}
+
+size_t log_record_format(const FmtProgram* program, char* buffer, size_t buffSize, const LogRecord* record)
+{
+    char* position = buffer;
+    const char* end = buffer + buffSize;
+
+    // widths, colors and gaps are resolved by the parser, 
+    // so every unit is just a sequence of copies
+    const FmtOp* fmtNode = program->ops;
+    const FmtOp* fmtEnd = program->ops + program->opsCount;
+    for (; fmtNode != fmtEnd; ++fmtNode)
+    {
+        switch (fmtNode->unit)
+        {
+            case FMT_UNIT_MAX_E:
+            {
+                _S("FMT_UNIT_MAX_E");
+
+                position = log_record_copy(position, end, program->pool + fmtNode->text, fmtNode->textLen);
+            }
+            break;
+
+            case FMT_FILENAME_E:
+            {
+                _S("FMT_FILENAME_E");
+
+                position = log_record_unit(program->pool, fmtNode, position, end, record->file, strlen(record->file));
+            }
+            break;
+
+            case FMT_LINE_E:
+            {
+                _S("FMT_LINE_E");
+
+                char lineString[LOG_DECIMAL_MAX_LEN];
+                size_t lineLen = log_record_decimal(lineString, (uint64_t)((record->line > 0) ? record->line : 0));
+                position = log_record_unit(program->pool, fmtNode, position, end, lineString, lineLen);
+            }
+            break;            
+
+            case FMT_THREAD_E:
+            {
+                _S("FMT_THREAD_E");
+
+                // rendered once per thread
+                position = log_record_unit(program->pool, fmtNode, position, end, record->threadLabel, record->threadLabelLen);
+            }
+            break;
+
+            case FMT_SEVERITY_E:
+            {    
+                _S("FMT_SEVERITY_E");
+                
+                if (fmtNode->flags & FMT_OP_STRUCTURED)
+                {
+                    // plain name, without alignment
+                    const char* severityString = severitiesString[record->severity];
+                    severityString += (*severityString == ' ') ? 1 : 0;
+                    position = log_record_unit(program->pool, fmtNode, position, end, severityString, strlen(severityString));
+                    break;
+                }
+
+                // color, padding and reset are prerendered: one string per severity
+                const char* severityString = program->pool + fmtNode->text + (size_t)record->severity * (fmtNode->textLen + 1);
+                position = log_record_copy(position, end, severityString, fmtNode->textLen);
+            }
+            break;
+
+            case FMT_TIMESTAMP_E:
+            {
+                _S("FMT_TIMESTAMP_E");
+                
+                char tsString[FMT_TS_MAX_LEN] = { 0 };
+                size_t tsLen = get_timestamp(program, fmtNode, &record->timestamp, tsString, sizeof(tsString));
+                if (tsLen)
+                {
+                    position = log_record_unit(program->pool, fmtNode, position, end, tsString, tsLen);
+                }
+            }
+            break;
+
+            case FMT_MESSAGE_E:
+            {
+                _S("FMT_MESSAGE_E");
+                
+                // already formatted by write_log()
+                position = (fmtNode->flags & FMT_OP_STRUCTURED) ? 
+                           log_record_escape(position, end, record->message, record->messageLen, fmtNode->flags) :
+                           log_record_copy(position, end, record->message, record->messageLen);
+            }
+            break;    
+
+            case FMT_ENDLINE_E:
+            {
+                _S("FMT_ENDLINE_E");
+                
+                position = log_record_copy(position, end, "\n", 1);
+            }
+            break;   
+
+            default:
+            {
+                _S("DEFAUILT_INVALID");
+                
+                // invalid unit
+                break;
+            }
+        }
+    }
+    
+    return (size_t)(position - buffer);
+}
+
+char* log_record_copy(char* position, const char* end, const char* source, size_t length)
+{
+    size_t available = (size_t)(end - position);
+    if (length > available)
+    {
+        // record is truncated
+        length = available;
+    }
+
+    memcpy(position, source, length);
+    return position + length;
+}
+
+char* log_record_fill(char* position, const char* end, char symbol, size_t count)
+{
+    size_t available = (size_t)(end - position);
+    if (count > available)
+    {
+        count = available;
+    }
+
+    memset(position, symbol, count);
+    return position + count;
+}
+
+size_t log_record_decimal(char* buffer, uint64_t value)
+{
+    // digits are produced from the end
+    char digits[LOG_DECIMAL_MAX_LEN];
+    char* first = digits + sizeof(digits);
+
+    while (value >= 100)
+    {
+        size_t pair = (size_t)(value % 100) * 2;
+        value /= 100;
+        *--first = digitPairs[pair + 1];
+        *--first = digitPairs[pair];
+    }
+
+    if (value >= 10)
+    {
+        size_t pair = (size_t)value * 2;
+        *--first = digitPairs[pair + 1];
+        *--first = digitPairs[pair];
+    }
+    else
+    {
+        *--first = (char)('0' + value);
+    }
+
+    size_t length = (size_t)((digits + sizeof(digits)) - first);
+    memcpy(buffer, first, length);
+    return length;
+}
+
+char* log_record_unit(const char* pool, const FmtOp* op, char* position, const char* end, const char* value, size_t valueLen)
+{
+    if (op->flags & FMT_OP_STRUCTURED)
+    {
+        // no colors and alignment in structured records
+        return log_record_escape(position, end, value, valueLen, op->flags);
+    }
+
+    // layout: <color><padding><value><padding><reset>, 
+    // only one of paddings is present
+    size_t padding = (op->width > valueLen) ? (op->width - valueLen) : 0;
+    bool padRight = (op->flags & FMT_OP_PAD_RIGHT);
+
+    if (op->colorLen)
+    {
+        position = log_record_copy(position, end, pool + op->color, op->colorLen);
+    }
+
+    if (padding && !padRight)
+    {
+        position = log_record_fill(position, end, ' ', padding);
+    }
+
+    position = log_record_copy(position, end, value, valueLen);
+
+    if (padding && padRight)
+    {
+        position = log_record_fill(position, end, ' ', padding);
+    }
+
+    if (op->colorLen)
+    {
+        position = log_record_copy(position, end, FMT_COLOR_RESET, FMT_COLOR_RESET_LEN);
+    }
+
+    return position;
+}
+
+char* log_record_escape(char* position, const char* end, const char* value, size_t valueLen, uint8_t flags)
+{
+    const unsigned char* symbol = (const unsigned char*)value;
+    const unsigned char* last = symbol + valueLen;
+
+    // logfmt value is quoted if it's empty or has spaces, '=' or escaped symbols
+    bool quoted = false;
+    if (flags & FMT_OP_LOGFMT)
+    {
+        quoted = (valueLen == 0);
+        for (const unsigned char* scan = symbol; (scan < last) && !quoted; ++scan)
+        {
+            quoted = fmtEscapes[*scan] || (*scan == ' ') || (*scan == '=');
+        }
+
+        if (!quoted)
+        {
+            return log_record_copy(position, end, value, valueLen);
+        }
+        position = log_record_copy(position, end, "\"", 1);
+    }
+
+    while (symbol < last)
+    {
+        // runs of plain symbols are copied at once
+        const unsigned char* run = symbol;
+        while ((symbol < last) && !fmtEscapes[*symbol])
+        {
+            ++symbol;
+        }
+        position = log_record_copy(position, end, (const char*)run, (size_t)(symbol - run));
+
+        if (symbol == last)
+        {
+            break;
+        }
+
+        char escape = fmtEscapes[*symbol];
+        char sequence[6] = { '\\', escape, '0', '0', 0, 0 };
+        size_t sequenceLen = 2;
+        if (escape == 'u')
+        {
+            sequence[4] = "0123456789abcdef"[*symbol >> 4];
+            sequence[5] = "0123456789abcdef"[*symbol & 0x0F];
+            sequenceLen = sizeof(sequence);
+        }
+        position = log_record_copy(position, end, sequence, sequenceLen);
+        ++symbol;
+    }
+
+    if (quoted)
+    {
+        position = log_record_copy(position, end, "\"", 1);
+    }
+
+    return position;
+}
+
+void log_record_write(LogOutputIdEnum output, LogSeverityEnum severity, const char* record, size_t recordLen)
+{
+    switch (output)
+    {
+        case LOG_OUTPUT_ID_STDOUT_E:
+        {
+        #ifdef __linux__
+            LogStdoutSink* sink = atomic_load_explicit(&stdoutSink, memory_order_acquire);
+            if (sink != NULL)
+            {
+                log_stdout_write(sink, severity, record, recordLen);
+                break;
+            }
+        #endif
+            write(fileno(stdout), record, recordLen);
+        }
+        break;
+
+        case LOG_OUTPUT_ID_FILE_E:
+        {
+        #ifdef __linux__
+            LogFileSink* sink = atomic_load_explicit(&fileSink, memory_order_acquire);
+            if (sink != NULL)
+            {
+                log_file_write(sink, severity, record, recordLen);
+            }
+        #else
+            (void)severity;
+        #endif
+        }
+        break;
+
+        case LOG_OUTPUT_ID_MMAP_E:
+        {
+        #ifdef __linux__
+            LogMmapSink* sink = atomic_load_explicit(&mmapSink, memory_order_acquire);
+            if (sink != NULL)
+            {
+                log_mmap_write(sink, record, recordLen);
+            }
+        #endif
+        }
+        break;
+
+        default:
+        {
+            // invalid output
+        }
+        break;
+    }
+}
+
+void log_stats_write(LogThreadContext* context, LogOutputIdEnum output, LogSeverityEnum severity, const char* record, size_t recordLen)
+{
+    if (context == NULL)
+    {
+        log_record_write(output, severity, record, recordLen);
+        return;
+    }
+
+    LOG_STATS_ADD(context->stats.bytes[output], recordLen);
+
+#ifdef __linux__
+    // two clock reads per write would cost more than most buffered writes
+    if ((context->stats.writes++ % LOG_STATS_LATENCY_SAMPLE) == 0)
+    {
+        struct timespec before, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        log_record_write(output, severity, record, recordLen);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+
+        uint64_t elapsed = (uint64_t)((int64_t)(after.tv_sec - before.tv_sec) * 1000000000ll + (after.tv_nsec - before.tv_nsec));
+        int bucket = 0;
+        while ((bucket < LOG_STATS_LATENCY_BUCKETS - 1) && (elapsed >> (LOG_STATS_LATENCY_SHIFT + bucket)))
+        {
+            ++bucket;
+        }
+        LOG_STATS_ADD(context->stats.latency[output][bucket], 1);
+        return;
+    }
+#endif
+
+    log_record_write(output, severity, record, recordLen);
+}
+
+#ifdef __linux__
+
+uint64_t log_stats_percentile(const uint64_t* buckets, unsigned int permille)
+{
+    uint64_t total = 0;
+    for (int bucket = 0; bucket < LOG_STATS_LATENCY_BUCKETS; ++bucket)
+    {
+        total += buckets[bucket];
+    }
+
+    // upper bound of the bucket which has the percentile, 0 if nothing is timed
+    uint64_t seen = 0;
+    for (int bucket = 0; total && (bucket < LOG_STATS_LATENCY_BUCKETS); ++bucket)
+    {
+        seen += buckets[bucket];
+        if (seen * 1000 >= total * permille)
+        {
+            return (uint64_t)1 << (LOG_STATS_LATENCY_SHIFT + bucket);
+        }
+    }
+
+    return 0;
+}
+
+void log_stats_dump(LogSeverityEnum severity)
+{
+    LogStats stats;
+    (void)logging_get_stats(&stats);
+
+    write_log(&statsSites[severity], statsSites[severity].fmt,
+              (unsigned long long)stats.records[LOG_SEVERITY_ERROR_E], (unsigned long long)stats.records[LOG_SEVERITY_WARN_E], 
+              (unsigned long long)stats.records[LOG_SEVERITY_INFO_E], (unsigned long long)stats.records[LOG_SEVERITY_DEBUG_E], 
+              (unsigned long long)stats.records[LOG_SEVERITY_TRACE_E], (unsigned long long)stats.suppressed, 
+              (unsigned long long)stats.dropped, (unsigned long long)stats.truncated,
+              (unsigned long long)stats.bytes[LOG_OUTPUT_ID_STDOUT_E], (unsigned long long)stats.bytes[LOG_OUTPUT_ID_FILE_E], 
+              (unsigned long long)stats.bytes[LOG_OUTPUT_ID_MMAP_E], (unsigned long long)stats.asyncDepthMax,
+              (unsigned long long)log_stats_percentile(stats.latency[LOG_OUTPUT_ID_STDOUT_E], 990), 
+              (unsigned long long)log_stats_percentile(stats.latency[LOG_OUTPUT_ID_FILE_E], 990), 
+              (unsigned long long)log_stats_percentile(stats.latency[LOG_OUTPUT_ID_MMAP_E], 990));
+}
+
+void* log_stats_dumper(void* arg)
+{
+    LogStatsDumper* dumper = (LogStatsDumper*)arg;
+
+    pthread_mutex_lock(&dumper->lock);
+    while (dumper->running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)(dumper->intervalMs % 1000) * 1000000L;
+        deadline.tv_sec += dumper->intervalMs / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        // spurious wakeups don't shorten the interval
+        int waited = 0;
+        while (dumper->running && (waited != ETIMEDOUT))
+        {
+            waited = pthread_cond_timedwait(&dumper->wakeup, &dumper->lock, &deadline);
+        }
+
+        if (dumper->running)
+        {
+            // written without the lock: stop isn't blocked by a slow sink
+            pthread_mutex_unlock(&dumper->lock);
+            log_stats_dump(dumper->severity);
+            pthread_mutex_lock(&dumper->lock);
+        }
+    }
+    pthread_mutex_unlock(&dumper->lock);
+
+    return NULL;
+}
+
+#endif
+
+LogThreadContext* log_thread_context()
+{
+    LogThreadContext* context = threadContext;
+    if (context != NULL)
+    {
+        return context;
+    }
+
+    // reuse context of the exited thread
+    for (context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&context->alive, &expected, true))
+        {
+            break;
+        }
+    }
+
+    if (context == NULL)
+    {
+        context = (LogThreadContext*)aligned_alloc(FMT_CACHE_LINE, FMT_ROUND_UP(sizeof(LogThreadContext), FMT_CACHE_LINE));
+        if (context == NULL)
+        {
+            return NULL;
+        }
+
+        memset(context, 0, sizeof(LogThreadContext));
+        atomic_init(&context->alive, true);
+
+        // lock-free push, contexts are never removed
+        context->next = atomic_load(&threadContexts);
+        while (!atomic_compare_exchange_weak(&threadContexts, &context->next, context))
+        {
+        }
+    }
+
+#ifdef __linux__
+    // destructor releases the context on thread exit,
+    // there is no such hook elsewhere: context isn't reused
+    pthread_once(&threadContextOnce, log_thread_context_key);
+    pthread_setspecific(threadContextKey, context);
+#endif
+
+    log_thread_label(context);
+    threadContext = context;
+    return context;
+}
+
+void log_thread_label(LogThreadContext* context)
+{
+#ifdef __linux__
+    context->threadId = (uint64_t)syscall(SYS_gettid);
+#elif defined(_WIN32)
+    context->threadId = (uint64_t)GetCurrentThreadId();
+#endif
+
+    context->threadLabelLen = (uint8_t)log_record_decimal(context->threadLabel, context->threadId);
+    context->threadNamed = false;
+}
+
+bool log_epoch_enter(LogThreadContext* context)
+{
+    if ((context == NULL) || (atomic_load_explicit(&context->epoch, memory_order_relaxed) != 0))
+    {
+        // nested call keeps the outer epoch
+        return false;
+    }
+
+    // seq_cst: published before any shared pointer is loaded
+    atomic_store(&context->epoch, atomic_load(&logEpoch));
+    return true;
+}
+
+void log_epoch_exit(LogThreadContext* context, bool entered)
+{
+    if (entered)
+    {
+        atomic_store_explicit(&context->epoch, 0, memory_order_release);
+    }
+}
+
+void log_epoch_synchronize()
+{
+    // replaced pointer is already unreachable: threads entering 
+    // from now on observe the new epoch and can't load it
+    uint64_t epoch = atomic_fetch_add(&logEpoch, 1) + 1;
+
+    for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        uint64_t observed = atomic_load(&context->epoch);
+        while ((observed != 0) && (observed < epoch))
+        {
+            sched_yield();
+            observed = atomic_load(&context->epoch);
+        }
+    }
+}
+
+#ifdef __linux__
+
+void log_thread_context_key()
+{
+    pthread_key_create(&threadContextKey, log_thread_exit);
+}
+
+void log_thread_exit(void* arg)
+{
+    LogThreadContext* context = (LogThreadContext*)arg;
+
+    bool entered = log_epoch_enter(context);
+    LogBinarySink* sink = atomic_load(&binarySink);
+    if (sink != NULL)
+    {
+        log_binary_flush(sink, context);
+    }
+    log_epoch_exit(context, entered);
+
+    atomic_store(&context->alive, false);
+}
+
+const char* log_binary_scan_spec(const char* spec, uint8_t* args, size_t* argCount, size_t maxArgs)
+{
+    // %[flags][width][.precision][length]conversion, spec points to '%'
+    const char* position = spec + 1;
+
+    while (strchr("-+ #0'", *position) && *position)
+    {
+        ++position;
+    }
+
+    for (int part = 0; part < 2; ++part)
+    {
+        if (*position == '*')
+        {
+            if (*argCount >= maxArgs)
+            {
+                return NULL;
+            }
+
+            args[(*argCount)++] = LOG_ARG_INT32_E;
+            ++position;
+        }
+
+        while ((*position >= '0') && (*position <= '9'))
+        {
+            ++position;
+        }
+
+        if ((part == 0) && (*position == '.'))
+        {
+            ++position;
+            continue;
+        }
+
+        break;
+    }
+
+    size_t longs = 0;
+    bool wide = false;
+    while (*position && strchr("hljztLq", *position))
+    {
+        longs += (*position == 'l') ? 1 : 0;
+        wide = wide || strchr("jztq", *position) || (*position == 'L');
+        ++position;
+    }
+
+    uint8_t arg = LOG_ARG_MAX_E;
+    switch (*position)
+    {
+        case '%':
+            return position + 1;
+
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+            arg = (wide || (longs >= 2) || ((longs == 1) && (sizeof(long) == 8))) ? LOG_ARG_INT64_E : LOG_ARG_INT32_E;
+            break;
+
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            // long double isn't supported
+            arg = wide ? LOG_ARG_MAX_E : LOG_ARG_DOUBLE_E;
+            break;
+
+        case 's':
+            arg = longs ? LOG_ARG_MAX_E : LOG_ARG_STRING_E;
+            break;
+
+        case 'p':
+            arg = LOG_ARG_POINTER_E;
+            break;
+
+        default:
+            // %n and unknown conversions
+            break;
+    }
+
+    if ((arg == LOG_ARG_MAX_E) || (*argCount >= maxArgs))
+    {
+        return NULL;
+    }
+
+    args[(*argCount)++] = arg;
+    return position + 1;
+}
+
+bool log_binary_signature(const char* fmt, uint8_t* args, uint8_t* argCount)
+{
+    size_t count = 0;
+
+    while (*fmt)
+    {
+        if (*fmt != '%')
+        {
+            ++fmt;
+            continue;
+        }
+
+        fmt = log_binary_scan_spec(fmt, args, &count, LOG_BINARY_MAX_ARGS);
+        if (fmt == NULL)
+        {
+            return false;
+        }
+    }
+
+    *argCount = (uint8_t)count;
+    return true;
+}
+
+LogBinarySite* log_binary_site(LogBinarySink* sink, const LogSite* site)
+{
+    // fast path: site is registered in this sink
+    uint64_t binary = atomic_load_explicit(&site->state->binary, memory_order_acquire);
+    if ((binary >> 32) == sink->generation)
+    {
+        return &sink->sites[(uint32_t)binary];
+    }
+
+    LogBinarySite* result = NULL;
+    pthread_mutex_lock(&sink->lock);
+
+    do
+    {
+        // another thread might have registered it
+        binary = atomic_load_explicit(&site->state->binary, memory_order_relaxed);
+        if ((binary >> 32) == sink->generation)
+        {
+            result = &sink->sites[(uint32_t)binary];
+            break;
+        }
+
+        if (sink->sitesCount >= LOG_BINARY_SITES_MAX)
+        {
+            // records of the new sites are dropped
+            break;
+        }
+
+        LogBinarySite* candidate = &sink->sites[sink->sitesCount];
+        candidate->fmt = site->fmt;
+        candidate->file = log_site_file(site);
+        candidate->line = site->line;
+        candidate->severity = (uint8_t)site->severity;
+        candidate->id = sink->sitesCount;
+        uint8_t args[LOG_BINARY_MAX_ARGS];
+        memcpy(candidate->args, log_site_signature(site, args, &candidate->argCount), sizeof(candidate->args));
+
+        // site entry goes directly to the file before any of its events
+        uint32_t lineValue = (uint32_t)site->line;
+        size_t fileLen = strlen(candidate->file) + 1;
+        size_t fmtLen = strlen(candidate->fmt) + 1;
+        size_t argsLen = (candidate->argCount == LOG_BINARY_PREFORMATTED) ? 0 : candidate->argCount;
+        size_t entryLen = 1 + 4 + 1 + 4 + fileLen + fmtLen + 1 + argsLen;
+        char* entry = (char*)malloc(entryLen);
+        if (entry == NULL)
+        {
+            break;
+        }
+
+        char* position = entry;
+        *position++ = (char)LOG_ENTRY_SITE_E;
+        memcpy(position, &candidate->id, 4);
+        position += 4;
+        *position++ = (char)candidate->severity;
+        memcpy(position, &lineValue, 4);
+        position += 4;
+        memcpy(position, candidate->file, fileLen);
+        position += fileLen;
+        memcpy(position, candidate->fmt, fmtLen);
+        position += fmtLen;
+        *position++ = (char)candidate->argCount;
+        memcpy(position, candidate->args, argsLen);
+
+        (void)log_write_all(sink->fd, entry, entryLen);
+        free(entry);
+
+        ++sink->sitesCount;
+        atomic_store_explicit(&site->state->binary, ((uint64_t)sink->generation << 32) | candidate->id, memory_order_release);
+        result = candidate;
+    } while (0);
+
+    pthread_mutex_unlock(&sink->lock);
+    return result;
+}
+
+void log_binary_flush(LogBinarySink* sink, LogThreadContext* context)
+{
+    if (context->binaryLen)
+    {
+        pthread_mutex_lock(&sink->lock);
+        (void)log_write_all(sink->fd, context->binary, context->binaryLen);
+        pthread_mutex_unlock(&sink->lock);
+        context->binaryLen = 0;
+    }
+}
+
+char* log_binary_encode(const char* fmt, const uint8_t* args, uint8_t argCount, va_list values, char* position, const char* end)
+{
+    if (argCount == LOG_BINARY_PREFORMATTED)
+    {
+        // length and rendered text, which is truncated if space is short
+        size_t available = (size_t)(end - position) - sizeof(uint32_t);
+        size_t capacity = (available < LOG_BINARY_STRING_MAX) ? available : LOG_BINARY_STRING_MAX;
+        int written = vsnprintf(position + sizeof(uint32_t), capacity, fmt, values);
+        uint32_t length = (written < 0) ? 0 : (((size_t)written < capacity) ? (uint32_t)written : (uint32_t)(capacity - 1));
+        memcpy(position, &length, sizeof(length));
+        return position + sizeof(length) + length;
+    }
+
+    for (uint8_t idx = 0; idx < argCount; ++idx)
+    {
+        // the rest of values is lost if space is short, decoder renders zeroes
+        size_t available = (size_t)(end - position);
+
+        switch (args[idx])
+        {
+            case LOG_ARG_INT32_E:
+            {
+                int32_t value = (int32_t)va_arg(values, int);
+                if (available < sizeof(value))
+                {
+                    return position;
+                }
+                memcpy(position, &value, sizeof(value));
+                position += sizeof(value);
+            }
+            break;
+
+            case LOG_ARG_INT64_E:
+            {
+                int64_t value = (int64_t)va_arg(values, long long);
+                if (available < sizeof(value))
+                {
+                    return position;
+                }
+                memcpy(position, &value, sizeof(value));
+                position += sizeof(value);
+            }
+            break;
+
+            case LOG_ARG_DOUBLE_E:
+            {
+                double value = va_arg(values, double);
+                if (available < sizeof(value))
+                {
+                    return position;
+                }
+                memcpy(position, &value, sizeof(value));
+                position += sizeof(value);
+            }
+            break;
+
+            case LOG_ARG_STRING_E:
+            {
+                const char* value = va_arg(values, const char*);
+                if (available < sizeof(uint32_t))
+                {
+                    return position;
+                }
+
+                value = value ? value : "(null)";
+                size_t limit = available - sizeof(uint32_t);
+                uint32_t length = (uint32_t)strnlen(value, (limit < LOG_BINARY_STRING_MAX) ? limit : LOG_BINARY_STRING_MAX);
+                memcpy(position, &length, sizeof(length));
+                memcpy(position + sizeof(length), value, length);
+                position += sizeof(length) + length;
+            }
+            break;
+
+            case LOG_ARG_POINTER_E:
+            {
+                uint64_t value = (uint64_t)(uintptr_t)va_arg(values, void*);
+                if (available < sizeof(value))
+                {
+                    return position;
+                }
+                memcpy(position, &value, sizeof(value));
+                position += sizeof(value);
+            }
+            break;
+
+            default:
+                break;
+        }
+    }
+
+    return position;
+}
+
+void log_binary_write(LogBinarySink* sink, LogThreadContext* context, const LogSite* callSite, va_list args)
+{
+    LogBinarySite* site = log_binary_site(sink, callSite);
+    if (site == NULL)
+    {
+        LOG_STATS_ADD(context->stats.dropped, 1);
+        return;
+    }
+
+    if (context->binary == NULL)
+    {
+        context->binary = (char*)malloc(LOG_BINARY_BUFFER_SIZE);
+        context->binaryLen = 0;
+        if (context->binary == NULL)
+        {
+            LOG_STATS_ADD(context->stats.dropped, 1);
+            return;
+        }
+    }
+
+    // the largest entries must fit: no checks while encoding
+    if ((LOG_BINARY_BUFFER_SIZE - context->binaryLen) < (LOG_BINARY_THREAD_MAX + LOG_BINARY_EVENT_MAX))
+    {
+        log_binary_flush(sink, context);
+    }
+
+    if (context->threadNamed && (context->binaryNamed != sink->generation))
+    {
+        // name goes once per sink, before the first event of the thread
+        char* name = context->binary + context->binaryLen;
+        name[0] = (char)LOG_ENTRY_THREAD_E;
+        memcpy(name + 1, &context->threadId, 8);
+        name[9] = (char)context->threadLabelLen;
+        memcpy(name + 10, context->threadLabel, context->threadLabelLen);
+        context->binaryLen += 10 + context->threadLabelLen;
+        context->binaryNamed = sink->generation;
+    }
+
+    char* entry = context->binary + context->binaryLen;
+    char* position = log_binary_encode(site->fmt, site->args, site->argCount, args, 
+                                       entry + LOG_BINARY_EVENT_HEADER, entry + LOG_BINARY_EVENT_MAX);
+
+    // header is written last, when payload length is known
+    struct timespec now;
+    log_record_clock(sink->clock, &now);
+    uint64_t ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    uint64_t thread = context->threadId;
+    uint32_t payloadLen = (uint32_t)(position - (entry + LOG_BINARY_EVENT_HEADER));
+
+    entry[0] = (char)LOG_ENTRY_EVENT_E;
+    memcpy(entry + 1, &site->id, 4);
+    memcpy(entry + 5, &ns, 8);
+    memcpy(entry + 13, &thread, 8);
+    memcpy(entry + 21, &payloadLen, 4);
+    context->binaryLen += (size_t)(position - entry);
+}
+
+size_t log_binary_render(const LogBinarySite* site, const char* payload, size_t payloadLen, char* buffer, size_t bufSize)
+{
+    const char* payloadEnd = payload + payloadLen;
+    char* position = buffer;
+    const char* end = buffer + bufSize - 1;     // reserve null-terminator
+    const char* fmt = site->fmt;
+
+    if (site->argCount == LOG_BINARY_PREFORMATTED)
+    {
+        uint32_t length = 0;
+        if (payloadLen >= sizeof(length))
+        {
+            memcpy(&length, payload, sizeof(length));
+        }
+        length = (payloadLen >= sizeof(length) && (length <= (payloadLen - sizeof(length)))) ? length : 0;
+        position = log_record_copy(position, end, payload + sizeof(length), length);
+        *position = '\0';
+        return (size_t)(position - buffer);
+    }
+
+    while (*fmt && (position < end))
+    {
+        if (*fmt != '%')
+        {
+            *position++ = *fmt++;
+            continue;
+        }
+
+        uint8_t args[LOG_BINARY_MAX_ARGS];
+        size_t argCount = 0;
+        const char* next = log_binary_scan_spec(fmt, args, &argCount, LOG_BINARY_MAX_ARGS);
+        if ((next == NULL) || (argCount == 0))
+        {
+            // '%%' or broken format
+            *position++ = '%';
+            fmt = next ? next : fmt + 1;
+            continue;
+        }
+
+        // rebuild the spec: '*' are replaced by stored values and length
+        // modifiers are normalized to the stored argument type
+        char spec[LOG_BINARY_SPEC_MAX];
+        size_t specLen = 0;
+        size_t argIdx = 0;
+        for (const char* symbol = fmt; symbol < (next - 1) && (specLen < (sizeof(spec) - 16)); ++symbol)
+        {
+            if (*symbol == '*')
+            {
+                int32_t value = 0;
+                if ((payload + sizeof(value)) <= payloadEnd)
+                {
+                    memcpy(&value, payload, sizeof(value));
+                    payload += sizeof(value);
+                }
+                specLen += (size_t)snprintf(spec + specLen, sizeof(spec) - specLen, "%d", value);
+                ++argIdx;
+            }
+            else if (!strchr("hljztLq", *symbol))
+            {
+                spec[specLen++] = *symbol;
+            }
+        }
+
+        uint8_t arg = args[argIdx];
+        if (arg == LOG_ARG_INT64_E)
+        {
+            spec[specLen++] = 'l';
+            spec[specLen++] = 'l';
+        }
+        spec[specLen++] = *(next - 1);
+        spec[specLen] = '\0';
+
+        size_t available = (size_t)(end - position) + 1;
+        int written = 0;
+        switch (arg)
+        {
+            case LOG_ARG_INT32_E:
+            {
+                int32_t value = 0;
+                if ((payload + sizeof(value)) <= payloadEnd)
+                {
+                    memcpy(&value, payload, sizeof(value));
+                }
+                payload += sizeof(value);
+                written = snprintf(position, available, spec, (int)value);
+            }
+            break;
+
+            case LOG_ARG_INT64_E:
+            {
+                int64_t value = 0;
+                if ((payload + sizeof(value)) <= payloadEnd)
+                {
+                    memcpy(&value, payload, sizeof(value));
+                }
+                payload += sizeof(value);
+                written = snprintf(position, available, spec, (long long)value);
+            }
+            break;
+
+            case LOG_ARG_DOUBLE_E:
+            {
+                double value = 0;
+                if ((payload + sizeof(value)) <= payloadEnd)
+                {
+                    memcpy(&value, payload, sizeof(value));
+                }
+                payload += sizeof(value);
+                written = snprintf(position, available, spec, value);
+            }
+            break;
+
+            case LOG_ARG_STRING_E:
+            {
+                uint32_t length = 0;
+                if ((payload + sizeof(length)) <= payloadEnd)
+                {
+                    memcpy(&length, payload, sizeof(length));
+                }
+                payload += sizeof(length);
+                size_t left = (payload <= payloadEnd) ? (size_t)(payloadEnd - payload) : 0;
+                length = ((length <= left) && (length <= LOG_BINARY_STRING_MAX)) ? length : 0;
+
+                // stored string isn't null-terminated
+                char value[LOG_BINARY_STRING_MAX + 1];
+                memcpy(value, payload, length);
+                value[length] = '\0';
+                payload += length;
+                written = snprintf(position, available, spec, value);
+            }
+            break;
+
+            case LOG_ARG_POINTER_E:
+            {
+                uint64_t value = 0;
+                if ((payload + sizeof(value)) <= payloadEnd)
+                {
+                    memcpy(&value, payload, sizeof(value));
+                }
+                payload += sizeof(value);
+                written = snprintf(position, available, spec, (void*)(uintptr_t)value);
+            }
+            break;
+
+            default:
+                break;
+        }
+
+        if (written > 0)
+        {
+            position += ((size_t)written < available) ? (size_t)written : (available - 1);
+        }
+        fmt = next;
+    }
+
+    *position = '\0';
+    return (size_t)(position - buffer);
+}
+
+int log_binary_event_compare(const void* left, const void* right)
+{
+    const LogBinaryEvent* first = (const LogBinaryEvent*)left;
+    const LogBinaryEvent* second = (const LogBinaryEvent*)right;
+
+    // same time: as they were written, thread's own records are never reordered
+    if (first->ns != second->ns)
+    {
+        return (first->ns < second->ns) ? -1 : 1;
+    }
+
+    return (first->payload < second->payload) ? -1 : (first->payload > second->payload);
+}
+
+void log_recorder_write(LogRecorder* recorder, LogThreadContext* context, const LogSite* site, va_list args)
+{
+    // ring is allocated on the first record of the thread
+    LogRecorderSlot* ring = atomic_load_explicit(&context->recorder, memory_order_relaxed);
+    if (ring == NULL)
+    {
+        ring = (LogRecorderSlot*)calloc(recorder->slots, sizeof(LogRecorderSlot));
+        if (ring == NULL)
+        {
+            return;
+        }
+        atomic_store_explicit(&context->recorder, ring, memory_order_release);
+    }
+
+    uint8_t signature[LOG_BINARY_MAX_ARGS];
+    uint8_t argCount = 0;
+    const uint8_t* argTypes = log_site_signature(site, signature, &argCount);
+
+    // old record is overwritten: readers see 0 and skip the slot
+    uint64_t sequence = atomic_load_explicit(&context->recorderNext, memory_order_relaxed);
+    LogRecorderSlot* slot = &ring[sequence & (recorder->slots - 1)];
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    struct timespec now;
+    log_record_clock(recorder->clock, &now);
+    slot->site = site;
+    slot->timestamp = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    slot->thread = context->threadId;
+
+    // arguments which don't fit the slot are lost, as in binary mode
+    char* end = log_binary_encode(site->fmt, argTypes, argCount, args, slot->payload, slot->payload + sizeof(slot->payload));
+    slot->payloadLen = (uint16_t)(end - slot->payload);
+
+    atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_release);
+    atomic_store_explicit(&context->recorderNext, sequence + 1, memory_order_release);
+}
+
+bool log_recorder_read(const LogRecorderSlot* slot, uint64_t sequence, LogRecorderSlot* copy)
+{
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != (sequence + 1))
+    {
+        // overwritten or being written
+        return false;
+    }
+
+    copy->site = slot->site;
+    copy->timestamp = slot->timestamp;
+    copy->thread = slot->thread;
+    copy->payloadLen = slot->payloadLen;
+    memcpy(copy->payload, slot->payload, sizeof(copy->payload));
+
+    // owner might have started to overwrite the slot while it was copied
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != (sequence + 1))
+    {
+        return false;
+    }
+
+    copy->payloadLen = (copy->payloadLen <= sizeof(copy->payload)) ? copy->payloadLen : (uint16_t)sizeof(copy->payload);
+    return true;
+}
+
+bool log_recorder_dump(LogRecorder* recorder)
+{
+    if (atomic_flag_test_and_set(&recorder->dumping))
+    {
+        // another thread is dumping, probably crashed as well
+        return false;
+    }
+
+    // only open(), write() and memcpy(): nothing is rendered here
+    int fd = open(recorder->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, LOG_FILE_MODE);
+    if (fd == -1)
+    {
+        atomic_flag_clear(&recorder->dumping);
+        return false;
+    }
+
+    // header as in binary mode: the dump is read by logging_decode_binary()
+    recorderBufferLen = 0;
+    log_recorder_append(fd, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN);
+    log_recorder_append(fd, &recorder->formatLen, sizeof(recorder->formatLen));
+    log_recorder_append(fd, recorder->format, recorder->formatLen);
+    memset(recorder->dumpSites, 0, sizeof(recorder->dumpSites));
+
+    // rings go one after another, decoder merges them by time;
+    // records written after this point are not dumped
+    for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        const LogRecorderSlot* ring = atomic_load_explicit(&context->recorder, memory_order_acquire);
+        if (ring == NULL)
+        {
+            continue;
+        }
+
+        if (context->threadNamed)
+        {
+            char name[LOG_BINARY_THREAD_MAX];
+            name[0] = (char)LOG_ENTRY_THREAD_E;
+            memcpy(name + 1, &context->threadId, 8);
+            name[9] = (char)context->threadLabelLen;
+            memcpy(name + 10, context->threadLabel, context->threadLabelLen);
+            log_recorder_append(fd, name, 10 + context->threadLabelLen);
+        }
+
+        uint64_t next = atomic_load_explicit(&context->recorderNext, memory_order_acquire);
+        for (uint64_t sequence = (next > recorder->slots) ? (next - recorder->slots) : 0; sequence < next; ++sequence)
+        {
+            LogRecorderSlot slot;
+            uint32_t siteId;
+            if (!log_recorder_read(&ring[sequence & (recorder->slots - 1)], sequence, &slot) ||
+                !log_recorder_site(recorder, fd, slot.site, &siteId))
+            {
+                continue;
+            }
+
+            char header[LOG_BINARY_EVENT_HEADER];
+            uint32_t payloadLen = slot.payloadLen;
+            header[0] = (char)LOG_ENTRY_EVENT_E;
+            memcpy(header + 1, &siteId, 4);
+            memcpy(header + 5, &slot.timestamp, 8);
+            memcpy(header + 13, &slot.thread, 8);
+            memcpy(header + 21, &payloadLen, 4);
+            log_recorder_append(fd, header, sizeof(header));
+            log_recorder_append(fd, slot.payload, slot.payloadLen);
+        }
+    }
+
+    (void)log_write_all(fd, recorderBuffer, recorderBufferLen);
+    close(fd);
+    atomic_flag_clear(&recorder->dumping);
+    return true;
+}
+
+void log_recorder_append(int fd, const void* data, size_t length)
+{
+    if (length > (sizeof(recorderBuffer) - recorderBufferLen))
+    {
+        (void)log_write_all(fd, recorderBuffer, recorderBufferLen);
+        recorderBufferLen = 0;
+    }
+
+    if (length > sizeof(recorderBuffer))
+    {
+        (void)log_write_all(fd, (const char*)data, length);
+        return;
+    }
+
+    memcpy(recorderBuffer + recorderBufferLen, data, length);
+    recorderBufferLen += length;
+}
+
+bool log_recorder_site(LogRecorder* recorder, int fd, const LogSite* site, uint32_t* id)
+{
+    // site entry precedes its first event in the dump
+    uint32_t index = (uint32_t)(((uintptr_t)site >> 3) * 2654435761u) & (LOG_BINARY_SITES_MAX - 1);
+    for (uint32_t probe = 0; probe < LOG_BINARY_SITES_MAX; ++probe, index = (index + 1) & (LOG_BINARY_SITES_MAX - 1))
+    {
+        if (recorder->dumpSites[index] == site)
+        {
+            *id = index;
+            return true;
+        }
+
+        if (recorder->dumpSites[index] == NULL)
+        {
+            recorder->dumpSites[index] = site;
+
+            // written by log_recorder_write(): the types are cached
+            uint8_t signature[LOG_BINARY_MAX_ARGS];
+            uint8_t argCount = 0;
+            const uint8_t* args = log_site_signature(site, signature, &argCount);
+            const char* file = log_site_file(site);
+            uint32_t line = (uint32_t)site->line;
+
+            char head[1 + 4 + 1 + 4];
+            head[0] = (char)LOG_ENTRY_SITE_E;
+            memcpy(head + 1, &index, 4);
+            head[5] = (char)site->severity;
+            memcpy(head + 6, &line, 4);
+            log_recorder_append(fd, head, sizeof(head));
+            log_recorder_append(fd, file, strlen(file) + 1);
+            log_recorder_append(fd, site->fmt, strlen(site->fmt) + 1);
+            log_recorder_append(fd, &argCount, 1);
+            log_recorder_append(fd, args, (argCount == LOG_BINARY_PREFORMATTED) ? 0 : argCount);
+
+            *id = index;
+            return true;
+        }
+    }
+
+    // more sites than a binary log takes: their records are lost
+    return false;
+}
+
+void log_recorder_signal(int signal)
+{
+    // best effort: the process is going down anyway
+    LogRecorder* recorder = atomic_load(&flightRecorder);
+    if (recorder == NULL)
+    {
+        (void)sigaction(signal, &(struct sigaction){ .sa_handler = SIG_DFL }, NULL);
+        raise(signal);
+        return;
+    }
+
+    (void)log_recorder_dump(recorder);
+
+    // previous handlers see the signal as if recorder wasn't there
+    for (size_t idx = 0; idx < (sizeof(recorderSignals) / sizeof(recorderSignals[0])); ++idx)
+    {
+        (void)sigaction(recorderSignals[idx], &recorder->previous[idx], NULL);
+    }
+    raise(signal);
+}
+
+void* log_bench_worker(void* arg)
+{
+    LogBenchThread* thread = (LogBenchThread*)arg;
+    const LogBenchConfig* config = thread->config;
+
+    char* payload = (char*)malloc(config->messageSize + 1);
+    if (payload != NULL)
+    {
+        memset(payload, 'x', config->messageSize);
+        payload[config->messageSize] = '\0';
+    }
+
+    LogBenchStart* start = thread->start;
+    pthread_mutex_lock(&start->lock);
+    ++start->waiting;
+    pthread_cond_broadcast(&start->wakeup);
+    while (!start->released)
+    {
+        pthread_cond_wait(&start->wakeup, &start->lock);
+    }
+    size_t records = start->aborted ? 0 : config->records;
+    pthread_mutex_unlock(&start->lock);
+
+    for (size_t idx = 0; idx < records; ++idx)
+    {
+        // clock overhead is included: it's the same for every configuration
+        struct timespec before;
+        struct timespec after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        if (LOG_ENABLED(benchSite.severity))
+        {
+            write_log(&benchSite, benchSite.fmt, (unsigned int)idx, payload ? payload : "");
+        }
+        clock_gettime(CLOCK_MONOTONIC, &after);
+
+        uint64_t ns = (uint64_t)(after.tv_sec - before.tv_sec) * 1000000000ull + (uint64_t)(after.tv_nsec - before.tv_nsec);
+        thread->latencies[idx] = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+    }
+
+    free(payload);
+    return NULL;
+}
+
+void* log_bench_drain(void* arg)
+{
+    int fd = *(int*)arg;
+    char buffer[64 * 1024];
+
+    // pipe reader of a real consumer does nothing else either
+    while (true)
+    {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if ((length == 0) || ((length < 0) && (errno != EINTR)))
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+int log_bench_compare(const void* first, const void* second)
+{
+    uint32_t left = *(const uint32_t*)first;
+    uint32_t right = *(const uint32_t*)second;
+    return (left > right) - (left < right);
+}
+
+uint32_t log_bench_percentile(const uint32_t* sorted, size_t count, double rank)
+{
+    // nearest-rank method
+    size_t index = (size_t)(rank * (double)count);
+    return sorted[(index < count) ? index : (count - 1)];
+}
+
+bool log_bench_number(const char* text, size_t max, size_t* value)
+{
+    // digits only: strtoull() takes a sign and wraps the value around
+    if ((text[0] < '0') || (text[0] > '9'))
+    {
+        return false;
+    }
+
+    char* end = NULL;
+    errno = 0;
+    unsigned long long number = strtoull(text, &end, 10);
+    if ((*end != '\0') || (errno == ERANGE) || (number > max))
+    {
+        return false;
+    }
+
+    *value = (size_t)number;
+    return true;
+}
+
+LogMmapSegment* log_mmap_segment_open(LogMmapSink* sink)
+{
+    LogMmapSegment* segment = (LogMmapSegment*)aligned_alloc(FMT_CACHE_LINE, FMT_ROUND_UP(sizeof(LogMmapSegment), FMT_CACHE_LINE));
+    if (segment == NULL)
+    {
+        return NULL;
+    }
+
+    // never overwrite segments of previous runs: <prefix>.<index>
+    int fd = -1;
+    unsigned int index = 0;
+    char name[LOG_MMAP_NAME_MAX];
+    pthread_mutex_lock(&sink->openLock);
+    while (fd == -1)
+    {
+        index = sink->nextIndex++;
+        snprintf(name, sizeof(name), "%s.%06u", sink->prefix, index);
+
+        fd = open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, LOG_FILE_MODE);
+        if ((fd == -1) && (errno != EEXIST))
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sink->openLock);
+
+    if (fd == -1)
+    {
+        aligned_free(segment);
+        return NULL;
+    }
+
+    char* base = MAP_FAILED;
+    if (ftruncate(fd, (off_t)sink->segmentSize) == 0)
+    {
+        // populate: page faults are paid here and not by logging threads
+        base = (char*)mmap(NULL, sink->segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        unlink(name);
+        aligned_free(segment);
+        return NULL;
+    }
+
+    atomic_init(&segment->tail, 0);
+    atomic_init(&segment->committed, 0);
+    segment->index = index;
+    segment->used = 0;
+    segment->closing = NULL;
+    segment->retired = NULL;
+    segment->base = base;
+    segment->size = sink->segmentSize;
+    segment->fd = fd;
+
+    return segment;
+}
+
+void log_mmap_segment_close(LogMmapSegment* segment, size_t used)
+{
+    munmap(segment->base, segment->size);
+    (void)ftruncate(segment->fd, (off_t)used);
+    close(segment->fd);
+    segment->base = NULL;
+}
+
+void log_mmap_segment_retire(LogMmapSink* sink, LogMmapSegment* segment)
+{
+    pthread_mutex_lock(&sink->rollLock);
+    segment->retired = sink->retired;
+    sink->retired = segment;
+    pthread_mutex_unlock(&sink->rollLock);
+}
+
+void log_mmap_roll(LogMmapSink* sink, LogMmapSegment* full, size_t used)
+{
+    pthread_mutex_lock(&sink->rollLock);
+
+    // spare is published at once, other writers don't wait for syscalls;
+    // it's opened here only if the preparer couldn't keep up
+    LogMmapSegment* next = sink->spare ? sink->spare : log_mmap_segment_open(sink);
+    sink->spare = NULL;
+    if (next != NULL)
+    {
+        atomic_store(&sink->current, next);
+
+        // full segment is closed by the preparer once its writers are done
+        full->used = used;
+        full->closing = sink->closing;
+        sink->closing = full;
+        pthread_cond_signal(&sink->wakeup);
+    }
+
+    pthread_mutex_unlock(&sink->rollLock);
+
+    if (next == NULL)
+    {
+        // can't continue: full segment is kept till logging_close_mmap()
+        while (atomic_load_explicit(&full->committed, memory_order_acquire) != used)
+        {
+            sched_yield();
+        }
+        atomic_store(&sink->failed, true);
+    }
+}
+
+void* log_mmap_preparer(void* arg)
+{
+    LogMmapSink* sink = (LogMmapSink*)arg;
+    bool openFailed = false;
+
+    pthread_mutex_lock(&sink->rollLock);
+    while (true)
+    {
+        if (sink->running && (sink->closing == NULL) && ((sink->spare != NULL) || openFailed))
+        {
+            if (openFailed)
+            {
+                // failed open is retried after a while, not in a busy loop
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += LOG_HOUSEKEEPER_MS / 1000;
+                (void)pthread_cond_timedwait(&sink->wakeup, &sink->rollLock, &deadline);
+                openFailed = false;
+            }
+            else
+            {
+                pthread_cond_wait(&sink->wakeup, &sink->rollLock);
+            }
+            continue;
+        }
+
+        LogMmapSegment* closing = sink->closing;
+        sink->closing = NULL;
+        bool running = sink->running;
+        bool needSpare = running && (sink->spare == NULL);
+        pthread_mutex_unlock(&sink->rollLock);
+
+        // syscalls are done without the lock: rolls aren't blocked by them
+        while (closing != NULL)
+        {
+            LogMmapSegment* next = closing->closing;
+
+            // writers which reserved space before 'used' are still copying
+            while (atomic_load_explicit(&closing->committed, memory_order_acquire) != closing->used)
+            {
+                sched_yield();
+            }
+            log_mmap_segment_close(closing, closing->used);
+            log_mmap_segment_retire(sink, closing);
+            closing = next;
+        }
+
+        LogMmapSegment* spare = needSpare ? log_mmap_segment_open(sink) : NULL;
+        openFailed = needSpare && (spare == NULL);
+
+        pthread_mutex_lock(&sink->rollLock);
+        if (spare != NULL)
+        {
+            // rolls only take the spare: the slot is still empty
+            sink->spare = spare;
+        }
+
+        if (!running && (sink->closing == NULL))
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sink->rollLock);
+
+    return NULL;
+}
+
+void log_mmap_write(LogMmapSink* sink, const char* record, size_t recordLen)
+{
+    if (recordLen > sink->segmentSize)
+    {
+        return;
+    }
+
+    while (!atomic_load_explicit(&sink->failed, memory_order_relaxed))
+    {
+        LogMmapSegment* segment = atomic_load_explicit(&sink->current, memory_order_acquire);
+        size_t offset = atomic_fetch_add_explicit(&segment->tail, recordLen, memory_order_relaxed);
+
+        if ((offset + recordLen) <= segment->size)
+        {
+            // fast path: plain copy to the page cache
+            memcpy(segment->base + offset, record, recordLen);
+            atomic_fetch_add_explicit(&segment->committed, recordLen, memory_order_release);
+            return;
+        }
+
+        if (offset <= segment->size)
+        {
+            // this record crossed the end: exactly one writer gets here
+            log_mmap_roll(sink, segment, offset);
+        }
+        else
+        {
+            // wait for the writer which crossed the end
+            while ((atomic_load_explicit(&sink->current, memory_order_acquire) == segment) && 
+                   !atomic_load_explicit(&sink->failed, memory_order_relaxed))
+            {
+                sched_yield();
+            }
+        }
+    }
+}
+
+bool log_write_all(int fd, const char* data, size_t length)
+{
+    while (length)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return true;
+}
+
+bool log_writev_all(int fd, struct iovec* vector, int count)
+{
+    while (count)
+    {
+        ssize_t written = writev(fd, vector, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        // partial write: skip what is written and continue from there
+        while (count && ((size_t)written >= vector->iov_len))
+        {
+            written -= (ssize_t)vector->iov_len;
+            ++vector;
+            --count;
+        }
+
+        if (count)
+        {
+            vector->iov_base = (char*)vector->iov_base + written;
+            vector->iov_len -= (size_t)written;
+        }
+    }
+
+    return true;
+}
+
+void log_stdout_write(LogStdoutSink* sink, LogSeverityEnum severity, const char* record, size_t recordLen)
+{
+    pthread_mutex_lock(&sink->lock);
+
+    bool flush = (severity <= sink->config.flushSeverity) || 
+                 ((sink->bufferLen + recordLen) > sink->config.bufferSize) ||
+                 (sink->config.flushRecords && ((sink->records + 1) >= sink->config.flushRecords));
+    if (!flush)
+    {
+        if (sink->records++ == 0)
+        {
+            // timed flush is armed by the first record of the batch
+            clock_gettime(CLOCK_REALTIME, &sink->firstRecord);
+            if (sink->config.flushIntervalMs)
+            {
+                pthread_cond_signal(&sink->wakeup);
+            }
+        }
+
+        memcpy(sink->buffer + sink->bufferLen, record, recordLen);
+        sink->bufferLen += recordLen;
+    }
+    else
+    {
+        // the record goes with the buffered ones, without being copied
+        struct iovec vector[2] = 
+        {
+            { .iov_base = sink->buffer, .iov_len = sink->bufferLen },
+            { .iov_base = (void*)record, .iov_len = recordLen }
+        };
+
+        // nothing to do on failure: records are lost either way
+        (void)log_writev_all(STDOUT_FILENO, sink->bufferLen ? vector : vector + 1, sink->bufferLen ? 2 : 1);
+        sink->bufferLen = 0;
+        sink->records = 0;
+    }
+
+    pthread_mutex_unlock(&sink->lock);
+}
+
+void* log_stdout_flusher(void* arg)
+{
+    LogStdoutSink* sink = (LogStdoutSink*)arg;
+
+    pthread_mutex_lock(&sink->lock);
+    while (sink->running)
+    {
+        if (sink->records == 0)
+        {
+            // nothing is buffered: wait for the first record
+            pthread_cond_wait(&sink->wakeup, &sink->lock);
+            continue;
+        }
+
+        struct timespec deadline = sink->firstRecord;
+        deadline.tv_nsec += (long)sink->config.flushIntervalMs * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        if (pthread_cond_timedwait(&sink->wakeup, &sink->lock, &deadline) == ETIMEDOUT)
+        {
+            // buffer might be flushed and refilled meanwhile: check its age again
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            int64_t ageMs = (int64_t)(now.tv_sec - sink->firstRecord.tv_sec) * 1000 + (now.tv_nsec - sink->firstRecord.tv_nsec) / 1000000;
+            if (sink->records && (ageMs >= (int64_t)sink->config.flushIntervalMs))
+            {
+                (void)log_write_all(STDOUT_FILENO, sink->buffer, sink->bufferLen);
+                sink->bufferLen = 0;
+                sink->records = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sink->lock);
+
+    return NULL;
+}
+
+void log_file_flush_locked(LogFileSink* sink)
+{
+    if (sink->bufferLen)
+    {
+    #ifdef LOG_URING_SUPPORTED
+        if (sink->uring != NULL)
+        {
+            // buffer is written in background, records go to the next one
+            sink->buffer = log_uring_write(sink->uring, sink->buffer, sink->bufferLen, sink->fd);
+        }
+        else
+    #endif
+        {
+            // nothing to do on failure: record is lost either way
+            (void)log_write_all(sink->fd, sink->buffer, sink->bufferLen);
+        }
+        sink->bufferLen = 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &sink->lastFlush);
+}
+
+void log_file_write(LogFileSink* sink, LogSeverityEnum severity, const char* record, size_t recordLen)
+{
+    pthread_mutex_lock(&sink->lock);
+
+    if ((sink->bufferLen + recordLen) > sink->config.bufferSize)
+    {
+        log_file_flush_locked(sink);
+    }
+
+    if (recordLen > sink->config.bufferSize)
+    {
+        // doesn't fit even empty buffer
+        log_file_write_direct(sink, record, recordLen);
+    }
+    else
+    {
+        memcpy(sink->buffer + sink->bufferLen, record, recordLen);
+        sink->bufferLen += recordLen;
+    }
+
+    sink->fileSize += recordLen;
+
+    if (severity <= sink->config.flushSeverity)
+    {
+        log_file_flush_locked(sink);
+    }
+
+    // reopen is done by the housekeeper, not before the retry time if the last one failed
+    if (sink->config.rotateSize && (sink->fileSize >= sink->config.rotateSize) && !sink->rotateRequested &&
+        (!sink->rotateRetry || (time(NULL) >= sink->rotateRetry)))
+    {
+        sink->rotateRequested = true;
+        pthread_cond_signal(&sink->wakeup);
+    }
+
+    pthread_mutex_unlock(&sink->lock);
+}
+
+int log_file_open(LogFileSink* sink)
+{
+    // io_uring writes by explicit offsets, which O_APPEND would ignore
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+#ifdef LOG_URING_SUPPORTED
+    flags |= (sink->uring != NULL) ? 0 : O_APPEND;
+#else
+    flags |= O_APPEND;
+#endif
+
+    int fd = open(sink->path, flags, LOG_FILE_MODE);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    // rotation by size takes into account already written data
+    sink->fileSize = 0;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0)
+    {
+        sink->fileSize = (size_t)fileStat.st_size;
+    }
+
+#ifdef LOG_URING_SUPPORTED
+    if (sink->uring != NULL)
+    {
+        sink->uring->offset = (uint64_t)sink->fileSize;
+    }
+#endif
+
+    return fd;
+}
+
+void log_file_write_direct(LogFileSink* sink, const char* data, size_t length)
+{
+#ifdef LOG_URING_SUPPORTED
+    if (sink->uring != NULL)
+    {
+        // earlier buffers are in flight: the record takes its place after them
+        (void)log_pwrite_all(sink->fd, data, length, sink->uring->offset);
+        sink->uring->offset += length;
+        return;
+    }
+#endif
+
+    (void)log_write_all(sink->fd, data, length);
+}
+
+time_t log_file_next_rotation(const LogFileSink* sink, time_t now)
+{
+    time_t period = (time_t)sink->config.rotatePeriodSec;
+    if (period == 0)
+    {
+        return 0;
+    }
+
+    // wall clock boundaries in local time, e.g. every hour at hh:00:00
+    struct tm timeStruct;
+    localtime_r(&now, &timeStruct);
+    time_t local = now + timeStruct.tm_gmtoff;
+
+    return now + (period - (local % period));
+}
+
+bool log_file_rotate(LogFileSink* sink, time_t now)
+{
+    // archive name: <path>.<YYYYmmdd-HHMMSS>.<rotation>
+    char stamp[32] = { 0 };
+    struct tm timeStruct;
+    localtime_r(&now, &timeStruct);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &timeStruct);
+
+    char archive[LOG_FILE_PATH_MAX + 48];
+    snprintf(archive, sizeof(archive), "%s.%s.%u", sink->path, stamp, sink->rotations + 1);
+
+    // records written until the swap still go to the renamed file
+    if (rename(sink->path, archive) != 0)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&sink->lock);
+    log_file_flush_locked(sink);
+
+#ifdef LOG_URING_SUPPORTED
+    if (sink->uring != NULL)
+    {
+        // writes in flight target the old file at its offsets
+        log_uring_wait(sink->uring, true);
+    }
+#endif
+
+    int oldFd = sink->fd;
+    int newFd = log_file_open(sink);
+    if (newFd == -1)
+    {
+        // the next attempt starts over with the same file
+        int error = errno;
+        (void)rename(archive, sink->path);
+        errno = error;
+        pthread_mutex_unlock(&sink->lock);
+        return false;
+    }
+
+    sink->fd = newFd;
+    sink->rotateRequested = false;
+    ++sink->rotations;
+    pthread_mutex_unlock(&sink->lock);
+
+    close(oldFd);
+    return true;
+}
+
+void* log_file_housekeeper(void* arg)
+{
+    LogFileSink* sink = (LogFileSink*)arg;
+
+    pthread_mutex_lock(&sink->lock);
+    while (sink->running)
+    {
+        uint32_t sleepMs = LOG_HOUSEKEEPER_MS;
+        if (sink->config.flushIntervalMs && (sink->config.flushIntervalMs < sleepMs))
+        {
+            sleepMs = sink->config.flushIntervalMs;
+        }
+
+        if (!sink->rotateRequested)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)sleepMs * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&sink->wakeup, &sink->lock, &deadline);
+        }
+
+        if (!sink->running)
+        {
+            break;
+        }
+
+        // timed flush
+        if (sink->config.flushIntervalMs && sink->bufferLen)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t ageMs = (int64_t)(now.tv_sec - sink->lastFlush.tv_sec) * 1000 + (now.tv_nsec - sink->lastFlush.tv_nsec) / 1000000;
+            if (ageMs >= (int64_t)sink->config.flushIntervalMs)
+            {
+                log_file_flush_locked(sink);
+            }
+        }
+
+        // rotation: file operations are done without the lock
+        time_t now = time(NULL);
+        bool byPeriod = sink->nextRotation && (now >= sink->nextRotation);
+        if (sink->rotateRequested || byPeriod)
+        {
+            pthread_mutex_unlock(&sink->lock);
+            bool rotated = log_file_rotate(sink, now);
+            int error = errno;
+            pthread_mutex_lock(&sink->lock);
+
+            if (rotated || byPeriod)
+            {
+                sink->nextRotation = log_file_next_rotation(sink, now);
+            }
+
+            bool report = !rotated && !sink->rotateFailed;
+            sink->rotateFailed = !rotated;
+            sink->rotateRetry = rotated ? 0 : (now + LOG_ROTATE_RETRY_SEC);
+            if (!rotated)
+            {
+                // records above the size don't ask again until the retry time
+                sink->rotateRequested = false;
+            }
+
+            if (report)
+            {
+                // goes to the current file as well: the sink lock can't be held
+                pthread_mutex_unlock(&sink->lock);
+                write_log(&rotationSite, rotationSite.fmt, sink->path, error, LOG_ROTATE_RETRY_SEC);
+                pthread_mutex_lock(&sink->lock);
+            }
+        }
+    }
+    pthread_mutex_unlock(&sink->lock);
+
+    return NULL;
+}
+
+#ifdef LOG_URING_SUPPORTED
+
+LogUring* log_uring_open(size_t bufferSize)
+{
+    bool result = false;
+    LogUring* uring = NULL;
+
+    do
+    {
+        uring = (LogUring*)calloc(1, sizeof(LogUring));
+        if (uring == NULL)
+        {
+            break;
+        }
+
+        uring->ringFd = -1;
+        uring->sqRing = MAP_FAILED;
+        uring->cqRing = MAP_FAILED;
+        uring->sqes = MAP_FAILED;
+
+        // at most one request per buffer is in flight
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        uring->ringFd = (int)syscall(SYS_io_uring_setup, LOG_URING_BUFFERS, &params);
+        if (uring->ringFd < 0)
+        {
+            // not supported by the kernel or forbidden
+            break;
+        }
+
+        uring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        uring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        uring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+        uring->sqRing = mmap(NULL, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFd, IORING_OFF_SQ_RING);
+        uring->cqRing = mmap(NULL, uring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFd, IORING_OFF_CQ_RING);
+        uring->sqes = (struct io_uring_sqe*)mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFd, IORING_OFF_SQES);
+        if ((uring->sqRing == MAP_FAILED) || (uring->cqRing == MAP_FAILED) || (uring->sqes == MAP_FAILED))
+        {
+            break;
+        }
+
+        char* sq = (char*)uring->sqRing;
+        char* cq = (char*)uring->cqRing;
+        uring->sqTail = (_Atomic uint32_t*)(sq + params.sq_off.tail);
+        uring->sqArray = (uint32_t*)(sq + params.sq_off.array);
+        uring->sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+        uring->cqHead = (_Atomic uint32_t*)(cq + params.cq_off.head);
+        uring->cqTail = (_Atomic uint32_t*)(cq + params.cq_off.tail);
+        uring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+        uring->cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+
+        // buffers are pinned once instead of on every write
+        uring->memory = (char*)mmap(NULL, LOG_URING_BUFFERS * bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (uring->memory == MAP_FAILED)
+        {
+            uring->memory = NULL;
+            break;
+        }
+
+        uring->bufferSize = bufferSize;
+        struct iovec vectors[LOG_URING_BUFFERS];
+        for (unsigned int idx = 0; idx < LOG_URING_BUFFERS; ++idx)
+        {
+            uring->buffers[idx].data = uring->memory + idx * bufferSize;
+            vectors[idx].iov_base = uring->buffers[idx].data;
+            vectors[idx].iov_len = bufferSize;
+        }
+
+        if (syscall(SYS_io_uring_register, uring->ringFd, IORING_REGISTER_BUFFERS, vectors, LOG_URING_BUFFERS) < 0)
+        {
+            // e.g. RLIMIT_MEMLOCK is too low
+            break;
+        }
+
+        // the first buffer is taken by the sink
+        uring->buffers[0].busy = true;
+        result = true;
+    } while (0);
+
+    if (!result && (uring != NULL))
+    {
+        log_uring_close(uring);
+        uring = NULL;
+    }
+
+    return uring;
+}
+
+void log_uring_close(LogUring* uring)
+{
+    if (uring->memory != NULL)
+    {
+        // rings are mapped: writes in flight are waited for
+        log_uring_wait(uring, true);
+    }
+
+    if (uring->memory != NULL)
+    {
+        munmap(uring->memory, LOG_URING_BUFFERS * uring->bufferSize);
+    }
+    if (uring->sqes != MAP_FAILED)
+    {
+        munmap(uring->sqes, uring->sqesSize);
+    }
+    if (uring->cqRing != MAP_FAILED)
+    {
+        munmap(uring->cqRing, uring->cqRingSize);
+    }
+    if (uring->sqRing != MAP_FAILED)
+    {
+        munmap(uring->sqRing, uring->sqRingSize);
+    }
+    if (uring->ringFd >= 0)
+    {
+        close(uring->ringFd);
+    }
+    free(uring);
+}
+
+bool log_pwrite_all(int fd, const char* data, size_t length, uint64_t offset)
+{
+    while (length)
+    {
+        ssize_t written = pwrite(fd, data, length, (off_t)offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += written;
+        length -= (size_t)written;
+        offset += (uint64_t)written;
+    }
+
+    return true;
+}
+
+bool log_uring_push(LogUring* uring, unsigned int index)
+{
+    LogUringBuffer* buffer = &uring->buffers[index];
+
+    // single submitter: the tail is only read back by the kernel
+    uint32_t tail = atomic_load_explicit(uring->sqTail, memory_order_relaxed);
+    uint32_t slot = tail & uring->sqMask;
+    struct io_uring_sqe* sqe = &uring->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = buffer->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(buffer->data + buffer->written);
+    sqe->len = (uint32_t)(buffer->length - buffer->written);
+    sqe->off = buffer->offset + buffer->written;
+    sqe->buf_index = (uint16_t)index;
+    sqe->user_data = index;
+
+    uring->sqArray[slot] = slot;
+    atomic_store_explicit(uring->sqTail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+bool log_uring_enter(LogUring* uring, unsigned int submit, unsigned int complete)
+{
+    while (true)
+    {
+        long entered = syscall(SYS_io_uring_enter, uring->ringFd, submit, complete, complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (entered >= 0)
+        {
+            return true;
+        }
+
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+}
+
+void log_uring_reap(LogUring* uring)
+{
+    unsigned int resubmit = 0;
+    uint32_t head = atomic_load_explicit(uring->cqHead, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(uring->cqTail, memory_order_acquire);
+
+    for (; head != tail; ++head)
+    {
+        const struct io_uring_cqe* cqe = &uring->cqes[head & uring->cqMask];
+        LogUringBuffer* buffer = &uring->buffers[cqe->user_data];
+
+        if (cqe->res > 0)
+        {
+            buffer->written += (size_t)cqe->res;
+        }
+
+        bool retry = (cqe->res > 0) ? (buffer->written < buffer->length) : ((cqe->res == -EAGAIN) || (cqe->res == -EINTR));
+        if (retry)
+        {
+            // short write: the rest goes at its own offset
+            log_uring_push(uring, (unsigned int)cqe->user_data);
+            ++resubmit;
+        }
+        else
+        {
+            // written or failed: nothing to do, records are lost either way
+            buffer->busy = false;
+        }
+    }
+
+    atomic_store_explicit(uring->cqHead, head, memory_order_release);
+
+    if (resubmit && !log_uring_enter(uring, resubmit, 0))
+    {
+        uring->broken = true;
+    }
+}
+
+void log_uring_wait(LogUring* uring, bool all)
+{
+    while (true)
+    {
+        log_uring_reap(uring);
+
+        unsigned int busy = 0;
+        unsigned int inFlight = 0;
+        for (unsigned int idx = 0; idx < LOG_URING_BUFFERS; ++idx)
+        {
+            busy += uring->buffers[idx].busy ? 1 : 0;
+            inFlight += (uring->buffers[idx].busy && uring->buffers[idx].length) ? 1 : 0;
+        }
+
+        if ((inFlight == 0) || (!all && (busy < LOG_URING_BUFFERS)))
+        {
+            return;
+        }
+
+        if (uring->broken || !log_uring_enter(uring, 0, 1))
+        {
+            // kernel doesn't serve the ring anymore: the same bytes go to 
+            // the same offsets, so output doesn't depend on what it wrote
+            uring->broken = true;
+            for (unsigned int idx = 0; idx < LOG_URING_BUFFERS; ++idx)
+            {
+                LogUringBuffer* buffer = &uring->buffers[idx];
+                if (buffer->busy && buffer->length)
+                {
+                    (void)log_pwrite_all(buffer->fd, buffer->data + buffer->written, buffer->length - buffer->written, buffer->offset + buffer->written);
+                    buffer->busy = false;
+                }
+            }
+            return;
+        }
+    }
+}
+
+char* log_uring_write(LogUring* uring, char* data, size_t length, int fd)
+{
+    unsigned int index = (unsigned int)((data - uring->memory) / uring->bufferSize);
+    LogUringBuffer* buffer = &uring->buffers[index];
+
+    buffer->length = length;
+    buffer->written = 0;
+    buffer->offset = uring->offset;
+    buffer->fd = fd;
+    uring->offset += length;
+
+    if (uring->broken)
+    {
+        (void)log_pwrite_all(fd, data, length, buffer->offset);
+        buffer->length = 0;
+        return data;
+    }
+
+    log_uring_push(uring, index);
+    if (!log_uring_enter(uring, 1, 0))
+    {
+        // request is dropped with the failed submission
+        uring->broken = true;
+        (void)log_pwrite_all(fd, data, length, buffer->offset);
+        buffer->length = 0;
+        return data;
+    }
+
+    // blocks only if every buffer is still in flight
+    log_uring_wait(uring, false);
+    for (unsigned int idx = 0; idx < LOG_URING_BUFFERS; ++idx)
+    {
+        if (!uring->buffers[idx].busy)
+        {
+            uring->buffers[idx].busy = true;
+            uring->buffers[idx].length = 0;
+            return uring->buffers[idx].data;
+        }
+    }
+
+    // unreachable: wait returns with a free buffer
+    return data;
+}
+
+#endif
+
+#endif // __linux__
+
+#ifdef __linux__
+
+bool log_async_start(size_t capacity, LogOverflowPolicyEnum policy, bool perThread)
+{
+    bool result = false;
+    LogAsyncRing* ring = NULL;
+
+    do
+    {
+        // capacity must be a power of two
+        if ((capacity < 2) || (capacity & (capacity - 1)))
+        {
+            break;
+        }
+
+        if (policy >= LOG_OVERFLOW_MAX_E)
+        {
+            break;
+        }
+
+        if (atomic_load(&asyncRing) != NULL)
+        {
+            // already started
+            break;
+        }
+
+        ring = (LogAsyncRing*)aligned_alloc(FMT_CACHE_LINE, FMT_ROUND_UP(sizeof(LogAsyncRing), FMT_CACHE_LINE));
+        if (ring == NULL)
+        {
+            break;
+        }
+        memset(ring, 0, sizeof(LogAsyncRing));
+
+        // per-thread queues are allocated by their producers
+        if (!perThread)
+        {
+            ring->slots = (LogAsyncSlot*)aligned_alloc(FMT_CACHE_LINE, capacity * sizeof(LogAsyncSlot));
+            if (ring->slots == NULL)
             {
-                _S("FMT_THREAD_E");
+                break;
+            }
 
-            #ifdef __linux__
-                pthread_t thread = pthread_self();
-            #elif defined(_WIN32)
-                DWORD thread = GetCurrentThreadId();
-            #endif
-            
-                char threadString[11] = { 0 };
-                (void) snprintf(threadString, sizeof(threadString), "0x%08lx", thread);
-                result = snprintf(bufPosition, sizeAvailable, unitFmt, threadString);
-                if (result != -1)
-                    written += result;
+            for (size_t idx = 0; idx < capacity; ++idx)
+            {
+                atomic_init(&ring->slots[idx].sequence, idx);
+            }
+        }
+
+        bool batchesAllocated = true;
+        for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+        {
+            ring->batch[output] = (char*)malloc(LOG_ASYNC_BATCH_SIZE);
+            ring->batchSeverity[output] = LOG_SEVERITY_MAX_E;
+            batchesAllocated = batchesAllocated && (ring->batch[output] != NULL);
+        }
+
+        if (!batchesAllocated)
+        {
+            break;
+        }
+
+        ring->mask = capacity - 1;
+        ring->policy = policy;
+        ring->perThread = perThread;
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->running, true);
+        atomic_init(&ring->sleeping, false);
+        pthread_mutex_init(&ring->lock, NULL);
+        pthread_cond_init(&ring->wakeup, NULL);
+
+        if (pthread_create(&ring->writer, NULL, log_async_writer, ring) != 0)
+        {
+            pthread_mutex_destroy(&ring->lock);
+            pthread_cond_destroy(&ring->wakeup);
+            break;
+        }
+
+        atomic_store(&asyncRing, ring);
+        result = true;
+    } while (0);
+
+    if (!result && (ring != NULL))
+    {
+        log_async_free(ring);
+    }
+
+    return result;
+}
+
+bool log_async_push(LogAsyncRing* ring, LogThreadContext* context, LogOutputIdEnum output, LogSeverityEnum severity, const char* record, size_t recordLen)
+{
+    bool result = false;
+    LogAsyncSlot* slot = NULL;
+    char* spill = NULL;
+
+    if (recordLen > LOG_ASYNC_SLOT_RECORD_SIZE)
+    {
+        spill = log_async_spill(record, recordLen);
+        if (spill == NULL)
+        {
+            return false;
+        }
+    }
+
+    size_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    while (slot == NULL)
+    {
+        LogAsyncSlot* candidate = &ring->slots[position & ring->mask];
+        size_t sequence = atomic_load_explicit(&candidate->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            // slot is free: try to claim it
+            if (atomic_compare_exchange_weak(&ring->head, &position, position + 1))
+            {
+                slot = candidate;
+            }
+        }
+        else if (difference < 0)
+        {
+            // ring is full
+            if (ring->policy == LOG_OVERFLOW_DROP_NEWEST_E)
+            {
+                free(spill);
+                return false;
+            }
+
+            if (ring->policy == LOG_OVERFLOW_DROP_OLDEST_E)
+            {
+                // act as a consumer: oldest record makes room for the newest
+                LogAsyncSlot discarded;
+                if (log_async_pop(ring, &discarded))
+                {
+                    LOG_STATS_ADD(context->stats.dropped, 1);
+                    log_async_release(&discarded);
+                }
+            }
+            else
+            {
+                // LOG_OVERFLOW_BLOCK_E: writer must be awake to free a slot
+                pthread_mutex_lock(&ring->lock);
+                pthread_cond_signal(&ring->wakeup);
+                pthread_mutex_unlock(&ring->lock);
+                sched_yield();
+            }
+
+            position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+        else
+        {
+            // another producer has claimed the slot
+            position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    slot->output = (uint16_t)output;
+    slot->severity = (uint16_t)severity;
+    slot->length = (uint32_t)recordLen;
+    if (spill != NULL)
+    {
+        memcpy(slot->record, &spill, sizeof(spill));
+    }
+    else
+    {
+        memcpy(slot->record, record, recordLen);
+    }
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+    result = true;
+
+    // pairs with the 'sleeping' store and 'head' load in the writer
+    if (atomic_load(&ring->sleeping))
+    {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_signal(&ring->wakeup);
+        pthread_mutex_unlock(&ring->lock);
+    }
+
+    return result;
+}
+
+bool log_async_pop(LogAsyncRing* ring, LogAsyncSlot* out)
+{
+    size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    while (true)
+    {
+        LogAsyncSlot* slot = &ring->slots[position & ring->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak(&ring->tail, &position, position + 1))
+            {
+                out->output = slot->output;
+                out->severity = slot->severity;
+                out->length = slot->length;
+                memcpy(out->record, slot->record, (slot->length > LOG_ASYNC_SLOT_RECORD_SIZE) ? sizeof(char*) : slot->length);
+                atomic_store_explicit(&slot->sequence, position + ring->mask + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            // empty or the oldest slot is not published yet
+            return false;
+        }
+        else
+        {
+            position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+bool log_async_queue_push(LogAsyncRing* ring, LogThreadContext* context, LogOutputIdEnum output, LogSeverityEnum severity, 
+                          uint64_t timestamp, const char* record, size_t recordLen)
+{
+    // queue is allocated on the first record of the thread
+    LogAsyncQueue* queue = atomic_load_explicit(&context->asyncQueue, memory_order_relaxed);
+    if (queue == NULL)
+    {
+        size_t size = FMT_ROUND_UP(sizeof(LogAsyncQueue) + (ring->mask + 1) * sizeof(LogAsyncSlot), FMT_CACHE_LINE);
+        queue = (LogAsyncQueue*)aligned_alloc(FMT_CACHE_LINE, size);
+        if (queue == NULL)
+        {
+            return false;
+        }
+
+        atomic_init(&queue->head, 0);
+        atomic_init(&queue->tail, 0);
+        queue->tailCache = 0;
+        atomic_store_explicit(&context->asyncQueue, queue, memory_order_release);
+    }
+
+    char* spill = NULL;
+    if (recordLen > LOG_ASYNC_SLOT_RECORD_SIZE)
+    {
+        spill = log_async_spill(record, recordLen);
+        if (spill == NULL)
+        {
+            return false;
+        }
+    }
+
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    while ((head - queue->tailCache) > ring->mask)
+    {
+        // looks full: writer's position is read only now
+        queue->tailCache = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if ((head - queue->tailCache) <= ring->mask)
+        {
+            break;
+        }
+
+        if (ring->policy == LOG_OVERFLOW_DROP_NEWEST_E)
+        {
+            free(spill);
+            return false;
+        }
+
+        // LOG_OVERFLOW_BLOCK_E: writer must be awake to free a slot
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_signal(&ring->wakeup);
+        pthread_mutex_unlock(&ring->lock);
+        sched_yield();
+    }
+
+    LogAsyncSlot* slot = &queue->slots[head & ring->mask];
+    slot->timestamp = timestamp;
+    slot->output = (uint16_t)output;
+    slot->severity = (uint16_t)severity;
+    slot->length = (uint32_t)recordLen;
+    if (spill != NULL)
+    {
+        memcpy(slot->record, &spill, sizeof(spill));
+    }
+    else
+    {
+        memcpy(slot->record, record, recordLen);
+    }
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    // pairs with the 'sleeping' store and emptiness check in the writer
+    if (atomic_load(&ring->sleeping))
+    {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_signal(&ring->wakeup);
+        pthread_mutex_unlock(&ring->lock);
+    }
+
+    return true;
+}
+
+char* log_async_spill(const char* record, size_t recordLen)
+{
+    // rare oversized record: slot carries a heap copy, released by the writer
+    char* spill = (char*)malloc(recordLen);
+    if (spill == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(spill, record, recordLen);
+    return spill;
+}
+
+void log_async_release(LogAsyncSlot* slot)
+{
+    if (slot->length > LOG_ASYNC_SLOT_RECORD_SIZE)
+    {
+        char* spill;
+        memcpy(&spill, slot->record, sizeof(spill));
+        free(spill);
+    }
+}
+
+void log_async_flush_batch(LogAsyncRing* ring, LogOutputIdEnum output)
+{
+    if (ring->batchLen[output])
+    {
+        log_stats_write(log_thread_context(), output, ring->batchSeverity[output], ring->batch[output], ring->batchLen[output]);
+        ring->batchLen[output] = 0;
+        ring->batchSeverity[output] = LOG_SEVERITY_MAX_E;
+    }
+}
+
+void log_async_consume(LogAsyncRing* ring, LogAsyncSlot* slot)
+{
+    LogOutputIdEnum output = (LogOutputIdEnum)slot->output;
+    if (slot->length > LOG_ASYNC_SLOT_RECORD_SIZE)
+    {
+        // keep the order: batched records go first
+        log_async_flush_batch(ring, output);
+        
+        char* spill;
+        memcpy(&spill, slot->record, sizeof(spill));
+        log_stats_write(log_thread_context(), output, (LogSeverityEnum)slot->severity, spill, slot->length);
+        log_async_release(slot);
+        return;
+    }
+
+    if ((ring->batchLen[output] + slot->length) > LOG_ASYNC_BATCH_SIZE)
+    {
+        log_async_flush_batch(ring, output);
+    }
+
+    memcpy(ring->batch[output] + ring->batchLen[output], slot->record, slot->length);
+    ring->batchLen[output] += slot->length;
+    if (slot->severity < ring->batchSeverity[output])
+    {
+        ring->batchSeverity[output] = (LogSeverityEnum)slot->severity;
+    }
+}
+
+size_t log_async_drain(LogAsyncRing* ring)
+{
+    size_t drained = 0;
+    LogAsyncSlot slot;
+
+    while ((drained < LOG_ASYNC_BATCH_RECORDS) && log_async_pop(ring, &slot))
+    {
+        log_async_consume(ring, &slot);
+        ++drained;
+    }
+
+    // one write per output for the whole batch
+    for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        log_async_flush_batch(ring, (LogOutputIdEnum)output);
+    }
+
+    return drained;
+}
+
+size_t log_async_drain_merged(LogAsyncRing* ring)
+{
+    size_t drained = 0;
+
+    // watermark: producers that are idle now take later timestamps,
+    // the busy ones push records not older than their pending timestamp
+    // after stop everything left is drained, whatever the clock did
+    // producers order records by the most precise clock in use
+    struct timespec stamps[FMT_CLOCK_MAX_E];
+    unsigned int clocks = atomic_load(&logClocks);
+    uint64_t now = log_record_clocks(clocks & (~clocks + 1), stamps);
+    uint64_t watermark = atomic_load(&ring->running) ? now : UINT64_MAX;
+    for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        uint64_t pending = atomic_load(&context->asyncPending);
+        if ((pending != LOG_ASYNC_PENDING_IDLE) && (pending < watermark))
+        {
+            watermark = pending;
+        }
+    }
+
+    // k-way merge of queue heads up to the watermark
+    while (drained < LOG_ASYNC_BATCH_RECORDS)
+    {
+        LogAsyncQueue* oldest = NULL;
+        uint64_t oldestTimestamp = watermark;
+        for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+        {
+            LogAsyncQueue* queue = atomic_load_explicit(&context->asyncQueue, memory_order_acquire);
+            if (queue == NULL)
+            {
+                continue;
+            }
+
+            size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&queue->head, memory_order_acquire))
+            {
+                continue;
+            }
+
+            uint64_t timestamp = queue->slots[tail & ring->mask].timestamp;
+            if ((timestamp < oldestTimestamp) || ((oldest == NULL) && (timestamp == oldestTimestamp)))
+            {
+                oldest = queue;
+                oldestTimestamp = timestamp;
             }
+        }
+
+        if (oldest == NULL)
+        {
+            break;
+        }
+
+        size_t tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+        log_async_consume(ring, &oldest->slots[tail & ring->mask]);
+        atomic_store_explicit(&oldest->tail, tail + 1, memory_order_release);
+        ++drained;
+    }
+
+    // one write per output for the whole batch
+    for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        log_async_flush_batch(ring, (LogOutputIdEnum)output);
+    }
+
+    return drained;
+}
+
+size_t log_async_depth(LogAsyncRing* ring)
+{
+    if (!ring->perThread)
+    {
+        // positions are read separately: with DROP_OLDEST producers move 
+        // the tail too, so it might pass the head seen a moment ago
+        size_t head = atomic_load(&ring->head);
+        size_t tail = atomic_load(&ring->tail);
+        size_t depth = (head > tail) ? head - tail : 0;
+        return (depth <= ring->mask) ? depth : ring->mask + 1;
+    }
+
+    size_t depth = 0;
+    for (LogThreadContext* context = atomic_load(&threadContexts); context != NULL; context = context->next)
+    {
+        LogAsyncQueue* queue = atomic_load(&context->asyncQueue);
+        if (queue != NULL)
+        {
+            size_t head = atomic_load(&queue->head);
+            size_t tail = atomic_load(&queue->tail);
+            depth += (head > tail) ? head - tail : 0;
+        }
+    }
+
+    return depth;
+}
+
+void* log_async_writer(void* arg)
+{
+    LogAsyncRing* ring = (LogAsyncRing*)arg;
+    LogThreadContext* context = log_thread_context();
+
+    while (true)
+    {
+        // high-water mark is sampled once per batch
+        size_t depth = log_async_depth(ring);
+        if ((context != NULL) && (depth > atomic_load_explicit(&context->stats.asyncDepthMax, memory_order_relaxed)))
+        {
+            atomic_store_explicit(&context->stats.asyncDepthMax, depth, memory_order_relaxed);
+        }
+
+        // sinks can be closed while the batch is written
+        bool entered = log_epoch_enter(context);
+        size_t drained = ring->perThread ? log_async_drain_merged(ring) : log_async_drain(ring);
+        log_epoch_exit(context, entered);
+
+        if (drained)
+        {
+            continue;
+        }
+
+        if (!atomic_load(&ring->running) && (log_async_depth(ring) == 0))
+        {
+            // queue is empty and no more records are expected
             break;
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        atomic_store(&ring->sleeping, true);
+
+        // recheck under 'sleeping' flag: producer either sees 
+        // the flag or its record is visible here
+        bool empty = (log_async_depth(ring) == 0);
+        if (empty && atomic_load(&ring->running))
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_ASYNC_IDLE_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&ring->wakeup, &ring->lock, &deadline);
+        }
+
+        atomic_store(&ring->sleeping, false);
+        pthread_mutex_unlock(&ring->lock);
+    }
+
+    return NULL;
+}
+
+void log_async_free(LogAsyncRing* ring)
+{
+    for (int output = 0; output < LOG_OUTPUT_ID_MAX_E; ++output)
+    {
+        free(ring->batch[output]);
+    }
+
+    if (ring->slots != NULL)
+    {
+        aligned_free(ring->slots);
+    }
+    
+    aligned_free(ring);
+}
+
+#endif // __linux__
+
+size_t get_timestamp(const FmtProgram* program, const FmtOp* op, const struct timespec* now, char* buffer, size_t bufSize)
+{
+    time_t rawTime = now->tv_sec;
+    uint32_t nsPart = (uint32_t)now->tv_nsec;
+
+    // strftime() part changes once per second
+    FmtTsCache* cache = &tsCache[((uintptr_t)op / sizeof(FmtOp)) & (FMT_TS_CACHE_SLOTS - 1)];
+    if ((cache->op != op) || (cache->generation != program->generation) || (cache->second != rawTime))
+    {
+        size_t length = 0;
+        if (op->textLen)
+        {
+            struct tm timeStruct;
+            localtime_r(&rawTime, &timeStruct);
+            length = strftime(cache->text, sizeof(cache->text), program->pool + op->text, &timeStruct);
+            if (length == 0)
+            {
+                cache->op = NULL;
+                return 0;
+            }
+        }
+
+        cache->op = op;
+        cache->generation = program->generation;
+        cache->second = rawTime;
+        cache->length = (uint8_t)length;
+    }
+
+    // patch the fraction part only
+    uint32_t fraction = 0;
+    size_t digits = 0;
+    if (op->flags & FMT_OP_TS_MS)
+    {
+        fraction = nsPart / 1000000;
+        digits = 3;
+    }
+    else if (op->flags & FMT_OP_TS_US)
+    {
+        fraction = nsPart / 1000;
+        digits = 6;
+    }
+
+    size_t written = cache->length + digits;
+    if (written >= bufSize)
+    {
+        return 0;
+    }
+
+    memcpy(buffer, cache->text, cache->length);
+    for (size_t idx = written; idx > cache->length; --idx)
+    {
+        buffer[idx - 1] = (char)('0' + (fraction % 10));
+        fraction /= 10;
+    }
+    buffer[written] = '\0';
+
+    return written;
+}
 
-            case FMT_SEVERITY_E:
-            {    
-                _S("FMT_SEVERITY_E");
-                
-                result = snprintf(bufPosition, sizeAvailable, unitFmt, severitiesString[severity]);
-                if (result != -1)
-                    written += result;
-            }
-            break;
+uint8_t fmt_timestamp_split(const char* option, size_t length, size_t* mainLen)
+{
+    uint8_t flags = 0;
+    *mainLen = length;
 
-            case FMT_TIMESTAMP_E:
+    // fraction is allowed only at the end: %f, %3f or %6f
+    if ((length >= 2) && (option[length - 1] == FMT_MS_SYMBOL))
+    {
+        if (option[length - 2] == FMT_UNIT_FIRST)
+        {
+            flags = FMT_OP_TS_MS;
+            *mainLen = length - 2;
+        }
+        else if ((length >= 3) && (option[length - 3] == FMT_UNIT_FIRST))
+        {
+            if (option[length - 2] == FMT_MS_DIGITS_SYMBOL)
             {
-                _S("FMT_TIMESTAMP_E");
-                
-                char tsString[32] = { 0 };
-                size_t offset = 0;
-                bool gotTs = get_timestamp(fmtNode->extOption, tsString, sizeof(tsString), &offset);
-                if (gotTs)
-                {
-                    result = snprintf(bufPosition, sizeAvailable, unitFmt, tsString);
-                    if (result != -1)
-                        written += result;
-                }
+                flags = FMT_OP_TS_MS;
+                *mainLen = length - 3;
             }
-            break;
-
-            case FMT_MESSAGE_E:
+            else if (option[length - 2] == FMT_US_DIGITS_SYMBOL)
             {
-                _S("FMT_MESSAGE_E");
-                
-                result = vsnprintf(bufPosition, sizeAvailable, fmt, args);
-                if (result != -1)
-                    written += result;
+                flags = FMT_OP_TS_US;
+                *mainLen = length - 3;
             }
-            break;    
+        }
+    }
 
-            case FMT_ENDLINE_E:
-            {
-                _S("FMT_ENDLINE_E");
-                
-                if (sizeAvailable > 1)
-                {
-                    *bufPosition = '\n';
-                    ++written;
-                }
-            }
-            break;   
+    return flags;
+}
 
-            default:
+FmtClockEnum fmt_timestamp_clock(const char* option, size_t length, size_t* mainLen)
+{
+    FmtClockEnum clock = FMT_CLOCK_REALTIME_E;
+    *mainLen = length;
+
+    // clock name follows the last separator, FMT_CLOCK_MAX_E if it's unknown
+    const char* separ = NULL;
+    for (const char* symbol = option; symbol < option + length; ++symbol)
+    {
+        if (*symbol == FMT_CLOCK_SEPAR)
+        {
+            separ = symbol;
+        }
+    }
+
+    if (separ != NULL)
+    {
+        size_t nameLen = (size_t)(option + length - separ - 1);
+        clock = FMT_CLOCK_MAX_E;
+        for (int idx = 0; idx < FMT_CLOCK_MAX_E; ++idx)
+        {
+            if ((strlen(fmtClockNames[idx]) == nameLen) && (strncmp(separ + 1, fmtClockNames[idx], nameLen) == 0))
             {
-                _S("DEFAUILT_INVALID");
-                
-                // invalid unit
+                clock = (FmtClockEnum)idx;
                 break;
             }
         }
-
-        fmtNode = fmtNode->next;
+        *mainLen = (size_t)(separ - option);
     }
-    
-    return written;
+
+    return clock;
 }
 
-void log_record_write(LogOutputIdEnum output, const char* record, size_t recordLen)
+bool fmt_builder_push_string(FmtProgramBuilder* builder, const char* string, size_t length, uint32_t* offset)
 {
-    switch (output)
+    // reserve one byte for null-terminator
+    size_t required = builder->poolSize + length + 1;
+    if (required > UINT32_MAX)
     {
-        case LOG_OUTPUT_ID_STDOUT_E:
+        return false;
+    }
+
+    if (builder->poolCapacity == 0)
+    {
+        builder->pool = builder->poolInline;
+        builder->poolCapacity = FMT_POOL_INITIAL;
+    }
+
+    if (required > builder->poolCapacity)
+    {
+        size_t capacity = builder->poolCapacity;
+        while (capacity < required)
         {
-            write(fileno(stdout), record, recordLen);
+            capacity *= 2;
         }
-        break;
 
-        case LOG_OUTPUT_ID_FILE_E:
+        // inline part is left for the heap on the first growth
+        bool isInline = (builder->pool == builder->poolInline);
+        char* pool = (char*)realloc(isInline ? NULL : builder->pool, capacity);
+        if (pool == NULL)
         {
-            // debug
-            printf("... Writing to the FILE ...");
+            return false;
         }
-        break;
 
-        default:
+        if (isInline)
         {
-            // invalid output
+            memcpy(pool, builder->poolInline, builder->poolSize);
         }
-        break;
+
+        builder->pool = pool;
+        builder->poolCapacity = capacity;
     }
+
+    memcpy(builder->pool + builder->poolSize, string, length);
+    builder->pool[builder->poolSize + length] = '\0';
+    *offset = (uint32_t)builder->poolSize;
+    builder->poolSize = required;
+
+    return true;
 }
 
-bool get_timestamp(char* format, char* buffer, size_t bufSize, size_t* written)
+bool fmt_builder_intern_string(FmtProgramBuilder* builder, const char* string, size_t length, uint32_t* offset)
 {
-    bool result = false;
+    // the same string or its tail with terminator is already in the pool, 
+    // e.g. repeated colors, gaps and timestamp options
+    for (size_t start = 0; (start + length) < builder->poolSize; ++start)
+    {
+        if ((builder->pool[start + length] == '\0') && (memcmp(builder->pool + start, string, length) == 0))
+        {
+            *offset = (uint32_t)start;
+            return true;
+        }
+    }
 
-    do
+    return fmt_builder_push_string(builder, string, length, offset);
+}
+
+bool fmt_builder_push_op(FmtProgramBuilder* builder, const FmtOp* op)
+{
+    if (builder->opsCapacity == 0)
     {
-    #ifdef __linux__
-        struct timespec tms;
-        clock_gettime(CLOCK_REALTIME, &tms);
-        uint64_t rawTime = (uint64_t)tms.tv_sec;
-        uint64_t msPart = ((uint64_t)tms.tv_nsec) / 1000000;
-    #elif defined (_WIN32)
-        struct _timeb timebuffer;
-        _ftime(&timebuffer);
-        uint64_t rawTime = (uint64_t)timebuffer.time;
-        uint64_t msPart = timebuffer.millitm;
-    #endif
+        builder->ops = builder->opsInline;
+        builder->opsCapacity = FMT_OPS_INITIAL;
+    }
 
-        // determine whether ms part should be processed
-        bool msRequired = false;
-        size_t lastIndex = strlen(format);
-        if (lastIndex >= 2)
+    if (builder->opsCount == builder->opsCapacity)
+    {
+        size_t capacity = builder->opsCapacity * 2;
+        bool isInline = (builder->ops == builder->opsInline);
+        FmtOp* ops = (FmtOp*)realloc(isInline ? NULL : builder->ops, capacity * sizeof(FmtOp));
+        if (ops == NULL)
         {
-            if ((format[lastIndex - 2] == FMT_UNIT_FIRST) && (format[lastIndex - 1] == FMT_MS_SYMBOL))
-            {
-                msRequired = true;
-
-                // remove %f so that strftime() may process
-                format[lastIndex - 2] = 0;
-                format[lastIndex - 1] = 0;
-            }
+            return false;
         }
 
-        // write main part
-        struct tm* timeStruct = localtime(&rawTime);
-        size_t writtenMain = strftime(buffer, bufSize, format, timeStruct);
-        if (writtenMain <= 0)
+        if (isInline)
         {
-            memset(buffer, 0, bufSize);
-            break;
+            memcpy(ops, builder->opsInline, builder->opsCount * sizeof(FmtOp));
         }
 
-        // write ms
-        int writtenMs = 0;
-        if (msRequired)
-        {
-            // restore %f
-            format[lastIndex - 2] = '%';
-            format[lastIndex - 1] = 'f';
-            
-            char* dest = buffer + writtenMain;
-            size_t size = bufSize - writtenMain;
+        builder->ops = ops;
+        builder->opsCapacity = capacity;
+    }
 
-            writtenMs = snprintf(dest, size, "%03u", (unsigned int)msPart);
-            if (writtenMs <= 0)
-            {
-                memset(buffer, 0, bufSize);
-                break;
-            }
+    builder->ops[builder->opsCount] = *op;
+    ++builder->opsCount;
+
+    return true;
+}
+
+void fmt_builder_free(FmtProgramBuilder* builder)
+{
+    if (builder->ops != builder->opsInline)
+    {
+        free(builder->ops);
+    }
+
+    if (builder->pool != builder->poolInline)
+    {
+        free(builder->pool);
+    }
+
+    builder->ops = NULL;
+    builder->pool = NULL;
+    builder->opsCount = builder->opsCapacity = 0;
+    builder->poolSize = builder->poolCapacity = 0;
+}
+
+FmtProgram* fmt_program_build(const FmtProgramBuilder* builder)
+{
+    // layout: | header | ops | pool |, each part starts on a cache line
+    size_t headerSize = FMT_ROUND_UP(sizeof(FmtProgram), FMT_CACHE_LINE);
+    size_t opsSize = FMT_ROUND_UP(builder->opsCount * sizeof(FmtOp), FMT_CACHE_LINE);
+    size_t totalSize = FMT_ROUND_UP(headerSize + opsSize + builder->poolSize, FMT_CACHE_LINE);
+
+    FmtProgram* program = (FmtProgram*)aligned_alloc(FMT_CACHE_LINE, totalSize);
+    if (program == NULL)
+    {
+        return NULL;
+    }
+
+    program->ops = (FmtOp*)((char*)program + headerSize);
+    program->pool = (char*)program->ops + opsSize;
+    program->opsCount = (uint32_t)builder->opsCount;
+    program->poolSize = (uint32_t)builder->poolSize;
+    program->generation = atomic_fetch_add(&programGeneration, 1) + 1;
+    program->clock = builder->clock;
+
+    if (builder->opsCount)
+    {
+        memcpy(program->ops, builder->ops, builder->opsCount * sizeof(FmtOp));
+    }
+
+    if (builder->poolSize)
+    {
+        memcpy(program->pool, builder->pool, builder->poolSize);
+    }
+
+    return program;
+}
+
+FmtProgram* fmt_compile(const char* format, bool colorless)
+{
+    if (!format || !strlen(format))
+    {
+        return NULL;
+    }
+
+    // structured records are read by machines: no colors
+    FmtStructureEnum structure = FMT_STRUCTURE_NONE_E;
+    for (int idx = FMT_STRUCTURE_NONE_E + 1; idx < FMT_STRUCTURE_MAX_E; ++idx)
+    {
+        size_t prefixLen = strlen(fmtStructurePrefixes[idx]);
+        if (strncmp(format, fmtStructurePrefixes[idx], prefixLen) == 0)
+        {
+            structure = (FmtStructureEnum)idx;
+            format += prefixLen;
+            colorless = true;
+            break;
         }
+    }
 
-        *written = writtenMain + writtenMs;
-        result = true;
-    } while (0);
+    FmtProgramBuilder builder = { .colorless = colorless, .clock = FMT_CLOCK_MAX_E, .structure = (uint8_t)structure };
+    FmtParser parser = 
+    {
+        .builder = &builder,
+        .parsed = false,
+        .callback = (structure == FMT_STRUCTURE_NONE_E) ? fmt_push_nodes : fmt_push_fields,
+        .currentState = FMT_PARSE_GAP,
+        .string = format,
+        .index = 0,
+        .currentBuff = { 0 },
+        .accumulateBuff = { 0 },
+        .currentIndex = 0,      
+        .accumulateIndex = 0,
+        .unit = FMT_UNIT_MAX_E,
+        .align = 0,
+        .color = { 0 },
+        .extOption = { 0 }
+    };
+    
+    fmt_parse_format(&parser);
 
-    return result;
+    // program is compiled only from the completely parsed format
+    bool closed = (structure == FMT_STRUCTURE_NONE_E) || fmt_push_fields_end(&builder);
+    FmtProgram* program = (parser.parsed && closed) ? fmt_program_build(&builder) : NULL;
+    fmt_builder_free(&builder);
+
+    return program;
 }
 
-void fmt_push_single_node(FmtUnitNode* node, LogOutputIdEnum output)
+bool fmt_prerender_severities(FmtProgramBuilder* builder, FmtOp* op)
 {
-    if (node == NULL)
+    bool result = true;
+    size_t severityLen = strlen(severitiesString[0]);
+    size_t renderedLen = op->colorLen + ((op->width > severityLen) ? op->width : severityLen) + (op->colorLen ? FMT_COLOR_RESET_LEN : 0);
+    if (renderedLen > UINT16_MAX)
     {
-        return;
+        return false;
     }
 
-    if (outFormats[output] == NULL)
+    char* rendered = (char*)malloc(renderedLen);
+    if (rendered == NULL)
     {
-        outFormats[output] = node;
+        return false;
     }
-    else
+
+    // severities are pushed one by one: pool + text + severity * (textLen + 1)
+    for (int severity = 0; severity < LOG_SEVERITY_MAX_E; ++severity)
     {
-        FmtUnitNode* curr = outFormats[output];
-        while (curr->next != NULL)
+        const char* string = severitiesString[severity];
+        char* end = log_record_unit(builder->pool, op, rendered, rendered + renderedLen, string, strlen(string));
+        
+        uint32_t offset = 0;
+        result = ((size_t)(end - rendered) == renderedLen) && fmt_builder_push_string(builder, rendered, renderedLen, &offset);
+        if (!result)
         {
-            curr = curr->next;
+            break;
+        }
+
+        if (severity == 0)
+        {
+            op->text = offset;
         }
-        curr->next = node;
     }
+
+    op->textLen = (uint16_t)renderedLen;
+    free(rendered);
+
+    return result;
 }
 
 bool fmt_push_nodes(void* arg)
@@ -607,16 +6751,21 @@ bool fmt_push_nodes(void* arg)
 
     // readability
     FmtParser* parser = (FmtParser*)arg;
-    int output = parser->output;
+    FmtProgramBuilder* builder = parser->builder;
     FmtUnitsEnum unit = parser->unit;
     long align = parser->align;
-    char* color = parser->color;
+    const char* color = parser->color;
     char* extOption = parser->extOption;
     char* gap = parser->accumulateBuff;
     size_t gapLen = strlen(gap);
 
-    FmtUnitNode* gapNode = NULL;
-    FmtUnitNode* unitNode = NULL;
+    char colorlessGap[FMT_BUFF_SIZE];
+    if (builder->colorless)
+    {
+        // escape sequences typed directly into the gap
+        gapLen = fmt_strip_colors(gap, gapLen, colorlessGap);
+        gap = colorlessGap;
+    }
 
     do
     {
@@ -627,58 +6776,209 @@ bool fmt_push_nodes(void* arg)
             break;
         }
         
-        // create gap node
+        // push ops: order 'gap' -> 'unit' is important
         if (gapLen)
         {
-            gapNode = (FmtUnitNode*)calloc(1, sizeof(FmtUnitNode));
-            if (gapNode == NULL)
-            {   
+            FmtOp gapOp = 
+            {
+                .unit = FMT_UNIT_MAX_E,  // indicator that op is gap and not unit
+                .textLen = (uint16_t)gapLen,
+            };
+
+            if (!fmt_builder_intern_string(builder, gap, gapLen, &gapOp.text) || 
+                !fmt_builder_push_op(builder, &gapOp))
+            {
                 break;
             }
-
-            gapNode->unit = FMT_UNIT_MAX_E;  // indicator that node is gap and not unit
-            memcpy(gapNode->gap, gap, gapLen);
         }
         
         if (unit != FMT_UNIT_MAX_E)
         {
-            unitNode = (FmtUnitNode*)calloc(1, sizeof(FmtUnitNode));;
-            if (unitNode == NULL)
-            {   
+            size_t extLen = strlen(extOption);
+            size_t colorLen = builder->colorless ? 0 : strlen(color);
+            if (colorLen > FMT_COLOR_MAX_LEN)
+            {
+                printf("ERROR = color is too long\n");
+                break;
+            }
+
+            FmtOp unitOp = 
+            {
+                .unit = (uint8_t)unit,
+                .colorLen = (uint8_t)colorLen,
+                .textLen = (uint16_t)extLen,
+                .width = (uint16_t)((align < 0) ? -align : align),
+                .flags = (align < 0) ? FMT_OP_PAD_RIGHT : 0,
+            };
+
+            if (unit == FMT_TIMESTAMP_E)
+            {
+                // clock and '%f' are resolved here once instead of every record
+                FmtClockEnum clock = fmt_timestamp_clock(extOption, extLen, &extLen);
+                builder->clock = (clock < builder->clock) ? (uint8_t)clock : builder->clock;
+                unitOp.flags |= fmt_timestamp_split(extOption, extLen, &extLen);
+                unitOp.textLen = (uint16_t)extLen;
+            }
+
+            if (!fmt_builder_intern_string(builder, extOption, extLen, &unitOp.text))
+            {
+                break;
+            }
+
+            if (colorLen && !fmt_builder_intern_string(builder, color, colorLen, &unitOp.color))
+            {
+                break;
+            }
+
+            if ((unit == FMT_SEVERITY_E) && !fmt_prerender_severities(builder, &unitOp))
+            {
                 break;
             }
 
-            unitNode->unit = unit;
-            unitNode->alignment = align;
-            unitNode->color = color;
-            memcpy(unitNode->extOption, extOption, strlen(extOption));
+            if (!fmt_builder_push_op(builder, &unitOp))
+            {
+                break;
+            }
         }
-        
-        // push nodes:
-        //   1. order 'gap' -> 'node' is important 
-        //   2. NULL node might be passed safety
-        fmt_push_single_node(gapNode, output);
-        fmt_push_single_node(unitNode, output);
 
         result = true;
     } while (0);
 
-    if (!result)
+    // color belongs to this unit only
+    parser->color[0] = '\0';
+
+    return result;
+}
+
+bool fmt_push_fields(void* arg)
+{
+    bool result = false;
+
+    // readability
+    FmtParser* parser = (FmtParser*)arg;
+    FmtProgramBuilder* builder = parser->builder;
+    FmtUnitsEnum unit = parser->unit;
+    char* extOption = parser->extOption;
+    bool json = (builder->structure == FMT_STRUCTURE_JSON_E);
+
+    do
     {
-        if (gapNode != NULL)
+        if ((unit == FMT_UNIT_MAX_E) || (unit == FMT_ENDLINE_E))
+        {
+            // gaps and line ends are replaced by the record syntax
+            result = true;
+            break;
+        }
+
+        // key is a gap, which also closes the previous JSON string and opens the next one
+        bool quoted = json && (unit != FMT_LINE_E);
+        char key[FMT_KEY_MAX_LEN];
+        int keyLen = json ? 
+            snprintf(key, sizeof(key), "%s%c\"%s\":%s", builder->quoteOpen ? "\"" : "", builder->hasFields ? ',' : '{', 
+                     fmtUnitMnemonics[unit], quoted ? "\"" : "") :
+            snprintf(key, sizeof(key), "%s%s=", builder->hasFields ? " " : "", fmtUnitMnemonics[unit]);
+
+        FmtOp keyOp = 
+        {
+            .unit = FMT_UNIT_MAX_E,
+            .textLen = (uint16_t)keyLen,
+        };
+
+        if (!fmt_builder_intern_string(builder, key, (size_t)keyLen, &keyOp.text) || 
+            !fmt_builder_push_op(builder, &keyOp))
         {
-            free(gapNode);
+            break;
         }
 
-        if (unitNode != NULL)
+        size_t extLen = strlen(extOption);
+        FmtOp unitOp = 
+        {
+            .unit = (uint8_t)unit,
+            .textLen = (uint16_t)extLen,
+            .flags = json ? FMT_OP_JSON : FMT_OP_LOGFMT,
+        };
+
+        if (unit == FMT_TIMESTAMP_E)
         {
-            free(unitNode);
+            FmtClockEnum clock = fmt_timestamp_clock(extOption, extLen, &extLen);
+            builder->clock = (clock < builder->clock) ? (uint8_t)clock : builder->clock;
+            unitOp.flags |= fmt_timestamp_split(extOption, extLen, &extLen);
+            unitOp.textLen = (uint16_t)extLen;
         }
-    }
+
+        if (!fmt_builder_intern_string(builder, extOption, extLen, &unitOp.text) || 
+            !fmt_builder_push_op(builder, &unitOp))
+        {
+            break;
+        }
+
+        builder->quoteOpen = quoted;
+        builder->hasFields = true;
+        result = true;
+    } while (0);
+
+    // colors and alignment are ignored
+    parser->color[0] = '\0';
 
     return result;
 }
 
+bool fmt_push_fields_end(FmtProgramBuilder* builder)
+{
+    const char* tail = "\n";
+    if (builder->structure == FMT_STRUCTURE_JSON_E)
+    {
+        tail = builder->quoteOpen ? "\"}\n" : (builder->hasFields ? "}\n" : "{}\n");
+    }
+
+    FmtOp tailOp = 
+    {
+        .unit = FMT_UNIT_MAX_E,
+        .textLen = (uint16_t)strlen(tail),
+    };
+
+    return fmt_builder_intern_string(builder, tail, tailOp.textLen, &tailOp.text) && fmt_builder_push_op(builder, &tailOp);
+}
+
+bool fmt_output_is_terminal(LogOutputIdEnum output)
+{
+    // files and segments never are
+    if (output != LOG_OUTPUT_ID_STDOUT_E)
+    {
+        return false;
+    }
+
+    // 0 for redirected stdout, as well as for invalid descriptor
+    return (isatty(fileno(stdout)) != 0);
+}
+
+size_t fmt_strip_colors(const char* string, size_t length, char* buffer)
+{
+    // drops "\033[...m" sequences, buffer fits the whole string
+    size_t stripped = 0;
+    bool sequence = false;
+
+    for (size_t idx = 0; idx < length; ++idx)
+    {
+        if (sequence)
+        {
+            sequence = (string[idx] != 'm');
+        }
+        else if ((string[idx] == '\033') && ((idx + 1) < length) && (string[idx + 1] == '['))
+        {
+            sequence = true;
+            ++idx;
+        }
+        else
+        {
+            buffer[stripped++] = string[idx];
+        }
+    }
+
+    buffer[stripped] = '\0';
+    return stripped;
+}
+
 FmtUnitsEnum fmt_find_unit(const char* string, size_t length)
 {
     FmtUnitsEnum unit;
@@ -697,20 +6997,31 @@ FmtUnitsEnum fmt_find_unit(const char* string, size_t length)
 bool fmt_verify_timestamp_option(const char* format)
 {   
     bool result = false;
+    size_t length = strlen(format);
+    FmtClockEnum clock = fmt_timestamp_clock(format, length, &length);
     
-    if (strlen(format) != 0)
+    if ((length != 0) && (clock != FMT_CLOCK_MAX_E))
     {
-        // format string must be modifiable
+        size_t mainLen = 0;
+        uint8_t flags = fmt_timestamp_split(format, length, &mainLen);
+        size_t digits = (flags & FMT_OP_TS_US) ? 6 : ((flags & FMT_OP_TS_MS) ? 3 : 0);
+        
+        // strftime() needs null-terminated format without fraction part
         char inBuffer[FMT_BUFF_SIZE] = { 0 };
-        memcpy(inBuffer, format, strlen(format));
+        memcpy(inBuffer, format, mainLen);
         
-        char outBuffer[FMT_BUFF_SIZE] = { 0 };
-        size_t written = 0;
-        result = get_timestamp(inBuffer, outBuffer, sizeof(outBuffer), &written);
+        // whole timestamp must fit FMT_TS_MAX_LEN at render time
+        char outBuffer[FMT_TS_MAX_LEN] = { 0 };
+        time_t now = time(NULL);
+        struct tm timeStruct;
+        localtime_r(&now, &timeStruct);
+
+        size_t written = mainLen ? strftime(outBuffer, sizeof(outBuffer) - digits, inBuffer, &timeStruct) : 0;
+        result = (written != 0) || ((mainLen == 0) && (digits != 0));
     }
 
     // debug
-    // printf("Timestamp = '%s'\n", buffer);
+    // printf("Timestamp = '%s'\n", outBuffer);
 
     return result;
 }
@@ -749,7 +7060,7 @@ bool fmt_parse_unit(FmtParser* parser, bool lastExists)
     // unit pattern = %<alignment>:<color>:<unit>[{extendedOption}]
     FmtUnitsEnum unit = FMT_UNIT_MAX_E;
     long align = 0;
-    char* color = NULL;
+    parser->color[0] = '\0';
 
     // deal only with unit without special symbols
     const char* inputString = parser->currentBuff + FMT_UNIT_START_LEN;      
@@ -811,6 +7122,7 @@ bool fmt_parse_unit(FmtParser* parser, bool lastExists)
             if (!isExtended)
             {
                 printf("ERROR = extended option is invalid: '%s'\n", parser->extOption);
+                break;
             }    
         }
 
@@ -827,7 +7139,7 @@ bool fmt_parse_unit(FmtParser* parser, bool lastExists)
                 char* longEnd;
                 align = strtol(inputString, &longEnd, 10);
                 
-                if (errno == ERANGE)
+                if ((errno == ERANGE) || (align > INT16_MAX) || (align < -INT16_MAX))
                 {
                     printf("ERROR = alignment overflow \n");
                     break;
@@ -844,23 +7156,14 @@ bool fmt_parse_unit(FmtParser* parser, bool lastExists)
         // one separator = alignment is passed
         if (actSeparCount >= 2)
         {
-            if (separIndecies[actSeparCount - 1] == (separIndecies[actSeparCount - 2] + 1))
-            {
-                // epmty color is given = default is used
-                color = NULL;
-            }
-            else
+            // epmty color is given = default is used
+            if (separIndecies[actSeparCount - 1] != (separIndecies[actSeparCount - 2] + 1))
             {
+                // unit is a part of the current buffer: color always fits
                 const char* colorString = inputString + (separIndecies[actSeparCount - 2] + 1);
                 size_t colorLen = separIndecies[actSeparCount - 1] - (separIndecies[actSeparCount - 2] + 1);
-
-                char* colorBuff = (char*)calloc(1, colorLen + 1);
-                if (!colorBuff)
-                {
-                    break;
-                }
-                memcpy(colorBuff, colorString, colorLen);
-                color = colorBuff;
+                memcpy(parser->color, colorString, colorLen);
+                parser->color[colorLen] = '\0';
             }
         }
 
@@ -869,7 +7172,6 @@ bool fmt_parse_unit(FmtParser* parser, bool lastExists)
 
     parser->unit = unit;
     parser->align = align;
-    parser->color = color;
 
     // debug
     // printf("unit=%s align=%li color=%scolor\033[m ext=%s\n", fmtUnitMnemonics[unit], align, color, parser->extOption);
@@ -898,7 +7200,7 @@ bool fmt_handle_unit(FmtParser* parser)
         //    parser->extOption);
         
         // main work
-        parser->callback(parser);
+        result = parser->callback(parser);
         FMT_ERROR_IF_FALSE(result);
 
         // prepare so that parsing might be continued
@@ -1175,8 +7477,32 @@ void fmt_parse_format(FmtParser* parser)
 
 
 
-int main()
+// test programs and other users include this file with LOG_NO_MAIN defined
+#ifndef LOG_NO_MAIN
+
+int main(int argc, char** argv)
 {
+    // offline decoder: ./a.out decode <binary log>
+    if ((argc == 3) && (strcmp(argv[1], "decode") == 0))
+    {
+        int decoded = logging_decode_binary(argv[2]);
+        logging_destroy();
+        return decoded;
+    }
+
+    // benchmark: ./a.out bench <null|pipe|file|mmap>[+async|+perthread][+batch][+uring] [threads] [records] [message size] [format]
+    if ((argc >= 3) && (strcmp(argv[1], "bench") == 0))
+    {
+        LogBenchConfig config;
+        int benchmarked = logging_parse_benchmark(argc - 2, argv + 2, &config) ? logging_benchmark(&config) : -1;
+        if (benchmarked != 0)
+        {
+            printf("ERROR = benchmark failed\n");
+        }
+        logging_destroy();
+        return benchmarked;
+    }
+
     LogOutputIdEnum output = LOG_OUTPUT_ID_STDOUT_E;
     const char* fmt = "%-15:\033[38;5;26m:timestamp{%T.%f}  %filename  %line   %-12:\033[38;5;166m:thread   [ %severity  ]  >>  %message%endl";
     bool result = logging_set_format(output, fmt);
@@ -1190,4 +7516,6 @@ int main()
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,314 @@
+// binary log decoder: valid logs decode, truncated and corrupted ones are rejected without overruns,
+// binary sites leave the text outputs to the others, threads' records are merged by time
+//      build: gcc -std=gnu11 -g -pthread -fsanitize=address,undefined test_binary_decoder.c -o test_binary_decoder
+//      run:   ./test_binary_decoder, exit code is the number of failed checks
+
+#define LOG_NO_MAIN
+#include "parse_format_string.c"
+
+#define TEST_LOG_PATH       "/tmp/test_binary_decoder.bin"
+#define TEST_BROKEN_PATH    "/tmp/test_binary_decoder.broken"
+#define TEST_OUTPUT_PATH    "/tmp/test_binary_decoder.out"
+#define TEST_TEXT_PATH      "/tmp/test_binary_decoder.txt"
+#define TEST_THREADS_PATH   "/tmp/test_binary_decoder.threads"
+#define TEST_RECORDS        (16)
+#define TEST_TEXT_RECORDS   (3)
+#define TEST_FLIPS          (400)
+#define TEST_THREADS        (3)
+#define TEST_TURNS          (300)
+
+static int failures = 0;
+
+// writer threads take turns: the order of turns is the order of time
+static pthread_mutex_t turnLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turnChanged = PTHREAD_COND_INITIALIZER;
+static int turn = 0;
+
+#define TEST_CHECK(condition)                                                       \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                             \
+        }                                                                           \
+    } while (0)
+
+static char* test_read(const char* path, size_t* size)
+{
+    char* data = NULL;
+    FILE* input = fopen(path, "rb");
+    if (input != NULL)
+    {
+        fseek(input, 0, SEEK_END);
+        long length = ftell(input);
+        fseek(input, 0, SEEK_SET);
+        data = (length > 0) ? (char*)malloc((size_t)length) : NULL;
+        if ((data != NULL) && (fread(data, 1, (size_t)length, input) != (size_t)length))
+        {
+            free(data);
+            data = NULL;
+        }
+        *size = (data != NULL) ? (size_t)length : 0;
+        fclose(input);
+    }
+
+    return data;
+}
+
+static bool test_write(const char* path, const char* data, size_t size)
+{
+    FILE* output = fopen(path, "wb");
+    bool written = (output != NULL) && (fwrite(data, 1, size, output) == size);
+    if (output != NULL)
+    {
+        fclose(output);
+    }
+
+    return written;
+}
+
+// descriptor 1 is redirected to the file, the saved one is returned
+static int test_redirect(const char* path)
+{
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int target = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ((savedStdout == -1) || (target == -1) || (dup2(target, STDOUT_FILENO) == -1))
+    {
+        return -1;
+    }
+    close(target);
+
+    return savedStdout;
+}
+
+static void test_restore(int savedStdout)
+{
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+}
+
+static size_t test_lines(const char* path)
+{
+    size_t size = 0;
+    size_t lines = 0;
+    char* output = test_read(path, &size);
+    for (size_t idx = 0; idx < size; ++idx)
+    {
+        lines += (output[idx] == '\n');
+    }
+    free(output);
+
+    return lines;
+}
+
+// decoder renders to descriptor 1: it's redirected to a file, lines are counted
+static int test_decode(const char* path, size_t* lines)
+{
+    int savedStdout = test_redirect(TEST_OUTPUT_PATH);
+    if (savedStdout == -1)
+    {
+        return -2;
+    }
+
+    int result = logging_decode_binary(path);
+    test_restore(savedStdout);
+    *lines = test_lines(TEST_OUTPUT_PATH);
+
+    return result;
+}
+
+static void test_write_log()
+{
+    unlink(TEST_LOG_PATH);
+    TEST_CHECK(logging_set_format(LOG_OUTPUT_ID_STDOUT_E, "%message%endl"));
+    TEST_CHECK(logging_set_severity(LOG_OUTPUT_ID_STDOUT_E, LOG_SEVERITY_INFO_E));
+    TEST_CHECK(logging_open_binary(TEST_LOG_PATH, "%timestamp{%T} %severity %thread %message%endl", LOG_SEVERITY_INFO_E));
+    logging_set_thread_name("decoder");
+
+    // other sites keep writing text while the binary sink is open
+    int savedStdout = test_redirect(TEST_TEXT_PATH);
+    TEST_CHECK(savedStdout != -1);
+
+    for (int idx = 0; idx < TEST_RECORDS - 1; ++idx)
+    {
+        INFO_BINARY("value %d %s %f %p", idx, "text", 1.5 * idx, (void*)&failures);
+    }
+    WARN_BINARY("plain");
+    for (int idx = 0; idx < TEST_TEXT_RECORDS; ++idx)
+    {
+        INFO("text %d", idx);
+    }
+
+    // less important than the configured severities: neither stored nor written
+    DEBUG_BINARY("debug");
+    DEBUG("debug");
+
+    if (savedStdout != -1)
+    {
+        test_restore(savedStdout);
+    }
+    logging_close_binary();
+
+    TEST_CHECK(test_lines(TEST_TEXT_PATH) == TEST_TEXT_RECORDS);
+}
+
+static void* test_turns(void* arg)
+{
+    int thread = (int)(intptr_t)arg;
+
+    pthread_mutex_lock(&turnLock);
+    while (turn < TEST_TURNS)
+    {
+        if (turn % TEST_THREADS == thread)
+        {
+            INFO_BINARY("turn %d", turn);
+            ++turn;
+            pthread_cond_broadcast(&turnChanged);
+        }
+        else
+        {
+            pthread_cond_wait(&turnChanged, &turnLock);
+        }
+    }
+    pthread_mutex_unlock(&turnLock);
+
+    return NULL;
+}
+
+static void test_merged()
+{
+    // every thread's buffer is flushed as a whole: the file has them one after another
+    unlink(TEST_THREADS_PATH);
+    TEST_CHECK(logging_open_binary(TEST_THREADS_PATH, "%message%endl", LOG_SEVERITY_INFO_E));
+
+    pthread_t threads[TEST_THREADS];
+    for (int idx = 0; idx < TEST_THREADS; ++idx)
+    {
+        TEST_CHECK(pthread_create(&threads[idx], NULL, test_turns, (void*)(intptr_t)idx) == 0);
+    }
+    for (int idx = 0; idx < TEST_THREADS; ++idx)
+    {
+        pthread_join(threads[idx], NULL);
+    }
+    logging_close_binary();
+
+    size_t lines = 0;
+    TEST_CHECK(test_decode(TEST_THREADS_PATH, &lines) == 0);
+    TEST_CHECK(lines == TEST_TURNS);
+
+    size_t size = 0;
+    char* output = test_read(TEST_OUTPUT_PATH, &size);
+    char* position = output;
+    for (int expected = 0; (position != NULL) && (expected < TEST_TURNS); ++expected)
+    {
+        int decoded = -1;
+        TEST_CHECK(sscanf(position, "turn %d", &decoded) == 1);
+        TEST_CHECK(decoded == expected);
+        position = memchr(position, '\n', size - (size_t)(position - output));
+        position = (position != NULL) ? position + 1 : NULL;
+    }
+    free(output);
+}
+
+static void test_valid()
+{
+    size_t lines = 0;
+    TEST_CHECK(test_decode(TEST_LOG_PATH, &lines) == 0);
+    TEST_CHECK(lines == TEST_RECORDS);
+}
+
+static void test_truncated(const char* data, size_t size)
+{
+    // every prefix: decoder may reject it, but never reads past its end
+    for (size_t length = 0; length < size; ++length)
+    {
+        size_t lines = 0;
+        TEST_CHECK(test_write(TEST_BROKEN_PATH, data, length));
+        int result = test_decode(TEST_BROKEN_PATH, &lines);
+        TEST_CHECK((result == 0) || (result == -1));
+        TEST_CHECK(lines <= TEST_RECORDS);
+    }
+}
+
+static void test_flipped(const char* data, size_t size)
+{
+    char* broken = (char*)malloc(size);
+    TEST_CHECK(broken != NULL);
+    if (broken == NULL)
+    {
+        return;
+    }
+
+    srand(1);
+    for (int flip = 0; flip < TEST_FLIPS; ++flip)
+    {
+        size_t lines = 0;
+        memcpy(broken, data, size);
+        broken[LOG_BINARY_MAGIC_LEN + (size_t)rand() % (size - LOG_BINARY_MAGIC_LEN)] ^= (char)(1 + rand() % 255);
+        TEST_CHECK(test_write(TEST_BROKEN_PATH, broken, size));
+        int result = test_decode(TEST_BROKEN_PATH, &lines);
+        TEST_CHECK((result == 0) || (result == -1));
+    }
+
+    free(broken);
+}
+
+static void test_site_id(const char* data, size_t size)
+{
+    // the first entry is a site description: its id is out of range
+    uint32_t formatLen;
+    memcpy(&formatLen, data + LOG_BINARY_MAGIC_LEN, sizeof(formatLen));
+    size_t site = LOG_BINARY_MAGIC_LEN + sizeof(formatLen) + formatLen;
+    TEST_CHECK((site < size) && (data[site] == LOG_ENTRY_SITE_E));
+    if (site + 5 > size)
+    {
+        return;
+    }
+
+    const uint32_t ids[] = { LOG_BINARY_SITES_MAX, 0x80000000u, UINT32_MAX };
+    char* broken = (char*)malloc(size);
+    TEST_CHECK(broken != NULL);
+    for (size_t idx = 0; (broken != NULL) && (idx < sizeof(ids) / sizeof(ids[0])); ++idx)
+    {
+        size_t lines = 0;
+        memcpy(broken, data, size);
+        memcpy(broken + site + 1, &ids[idx], sizeof(ids[idx]));
+        TEST_CHECK(test_write(TEST_BROKEN_PATH, broken, size));
+        TEST_CHECK(test_decode(TEST_BROKEN_PATH, &lines) == -1);
+        TEST_CHECK(lines == 1);     // error message only
+    }
+
+    free(broken);
+}
+
+int main()
+{
+    test_write_log();
+
+    size_t size = 0;
+    char* data = test_read(TEST_LOG_PATH, &size);
+    TEST_CHECK((data != NULL) && (size > LOG_BINARY_MAGIC_LEN));
+    if ((data != NULL) && (size > LOG_BINARY_MAGIC_LEN))
+    {
+        test_valid();
+        test_truncated(data, size);
+        test_flipped(data, size);
+        test_site_id(data, size);
+    }
+    free(data);
+
+    test_merged();
+
+    unlink(TEST_LOG_PATH);
+    unlink(TEST_TEXT_PATH);
+    unlink(TEST_THREADS_PATH);
+    unlink(TEST_BROKEN_PATH);
+    unlink(TEST_OUTPUT_PATH);
+    logging_destroy();
+
+    fprintf(stderr, "%s: %d failed\n", __FILE__, failures);
+    return failures;
+}
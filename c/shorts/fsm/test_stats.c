@@ -0,0 +1,132 @@
+// logging self-metrics: counters match what was logged and written, dumper reports them
+//      build: gcc -std=gnu11 -g -pthread -fsanitize=address,undefined test_stats.c -o test_stats
+//      run:   ./test_stats, exit code is the number of failed checks
+
+#define LOG_NO_MAIN
+#include "parse_format_string.c"
+
+#define TEST_LOG_PATH       "/tmp/test_stats.log"
+#define TEST_INFOS          (100)
+#define TEST_WARNINGS       (10)
+#define TEST_DEBUGS         (50)
+#define TEST_BURST          (10)
+#define TEST_DUMP_MS        (20)
+
+static int failures = 0;
+
+#define TEST_CHECK(condition)                                                       \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                             \
+        }                                                                           \
+    } while (0)
+
+static size_t test_file_size(size_t* dumps)
+{
+    size_t size = 0;
+    char line[1024];
+    FILE* input = fopen(TEST_LOG_PATH, "r");
+    *dumps = 0;
+
+    while ((input != NULL) && (fgets(line, sizeof(line), input) != NULL))
+    {
+        size += strlen(line);
+        *dumps += (strstr(line, "logging stats:") != NULL);
+    }
+
+    if (input != NULL)
+    {
+        fclose(input);
+    }
+
+    return size;
+}
+
+static void test_counters()
+{
+    LogStats before;
+    TEST_CHECK(logging_get_stats(&before));
+
+    for (int idx = 0; idx < TEST_INFOS; ++idx)
+    {
+        INFO("info %d", idx);
+    }
+    for (int idx = 0; idx < TEST_WARNINGS; ++idx)
+    {
+        WARN("warning %d", idx);
+    }
+
+    // one call site: burst passes, the rest is suppressed unless the bucket refills meanwhile
+    for (int idx = 0; idx < TEST_DEBUGS; ++idx)
+    {
+        DEBUG("debug %d", idx);
+    }
+
+    LogStats after;
+    TEST_CHECK(logging_get_stats(&after));
+
+    uint64_t debugs = after.records[LOG_SEVERITY_DEBUG_E] - before.records[LOG_SEVERITY_DEBUG_E];
+    uint64_t suppressed = after.suppressed - before.suppressed;
+    TEST_CHECK(after.records[LOG_SEVERITY_INFO_E] - before.records[LOG_SEVERITY_INFO_E] == TEST_INFOS);
+    TEST_CHECK(after.records[LOG_SEVERITY_WARN_E] - before.records[LOG_SEVERITY_WARN_E] == TEST_WARNINGS);
+    TEST_CHECK(debugs + suppressed == TEST_DEBUGS);
+    TEST_CHECK(debugs >= TEST_BURST);
+    TEST_CHECK(suppressed >= TEST_DEBUGS - 2 * TEST_BURST);
+    TEST_CHECK(after.dropped == before.dropped);
+    TEST_CHECK(after.truncated == before.truncated);
+
+    // latency is sampled, never more often than records are written
+    uint64_t written = TEST_INFOS + TEST_WARNINGS + debugs;
+    uint64_t sampled = 0;
+    for (int bucket = 0; bucket < LOG_STATS_LATENCY_BUCKETS; ++bucket)
+    {
+        sampled += after.latency[LOG_OUTPUT_ID_FILE_E][bucket] - before.latency[LOG_OUTPUT_ID_FILE_E][bucket];
+    }
+    TEST_CHECK(sampled > 0);
+    TEST_CHECK(sampled <= written);
+
+    // every byte handed to the sink is in the file
+    logging_close_file();
+
+    size_t dumps = 0;
+    TEST_CHECK(after.bytes[LOG_OUTPUT_ID_FILE_E] - before.bytes[LOG_OUTPUT_ID_FILE_E] == test_file_size(&dumps));
+    TEST_CHECK(dumps == 0);
+}
+
+static void test_dump()
+{
+    unlink(TEST_LOG_PATH);
+    LogFileConfig file = { .path = TEST_LOG_PATH };
+    TEST_CHECK(logging_open_file(&file));
+
+    TEST_CHECK(logging_start_stats_dump(TEST_DUMP_MS, LOG_SEVERITY_WARN_E));
+    usleep(5 * TEST_DUMP_MS * 1000);
+    logging_stop_stats_dump();
+    logging_close_file();
+
+    size_t dumps = 0;
+    test_file_size(&dumps);
+    TEST_CHECK(dumps > 0);
+}
+
+int main()
+{
+    unlink(TEST_LOG_PATH);
+    LogFileConfig file = { .path = TEST_LOG_PATH };
+    TEST_CHECK(logging_set_format(LOG_OUTPUT_ID_FILE_E, "%severity %message%endl"));
+    TEST_CHECK(logging_set_severity(LOG_OUTPUT_ID_FILE_E, LOG_SEVERITY_DEBUG_E));
+    TEST_CHECK(logging_set_limit(LOG_SEVERITY_DEBUG_E, TEST_BURST, TEST_BURST, 0));
+    TEST_CHECK(logging_open_file(&file));
+
+    test_counters();
+    test_dump();
+
+    unlink(TEST_LOG_PATH);
+    logging_destroy();
+
+    fprintf(stderr, "%s: %d failed\n", __FILE__, failures);
+    return failures;
+}